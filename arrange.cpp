@@ -1,16 +1,26 @@
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #include <sndfile.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
+#include <limits.h>
 
 #include <thread>
+#include <atomic>
 #include <vector>
+#include <unordered_map>
+#include <memory>
 #include <fstream>
 
 #include "arrange.h"
+#include "smf.h"
+#include "peaks.h"
+#include "uistats.h"
+#include "journal.h"
+#include "projfile.h"
 
 #include <sndfile.h>
 
@@ -22,6 +32,7 @@ extern "C" {
 
 extern void x11_stuff_init();
 extern void x11_exit_cleanup();
+extern void x11_wake();
 
 using namespace std;
 
@@ -47,22 +58,29 @@ struct Instrument {
   int midi_channel;
   float* pcm;
   uint32_t pcm_size;
+  PeakPyramid* peaks; // waveform overview, built in the background
 };
 
-struct MPRegion {
-  int id;
-  int track_id;
-  long inpoint;
-  long length;
-  int instrument_id;
-  bool selected;
-  vector<Note> notes;
+enum automation_type_t {
+  A_CC,
+  A_PITCH_BEND,
+  A_PROGRAM
+};
 
-  bool fired; // fired in current loop?
-  bool stopped; // note off sent in current loop?
-  View* view;
+// breakpoints are kept as two parallel, time-sorted arrays
+// (time in region units, value in the raw MIDI range of the lane type)
+struct AutomationLane {
+  automation_type_t type;
+  int controller; // only used by A_CC
 
-  long _prev_inpoint;
+  vector<int32_t> times;
+  vector<int16_t> values;
+
+  // playback state, only used in the copies the jack thread plays (see
+  // Schedule)
+  int cursor;      // index of the first breakpoint after the playhead
+  int last_value;  // -1 = nothing sent in current loop
+  double last_sent_smp;
 };
 
 struct Track {
@@ -75,7 +93,7 @@ struct Track {
   
   View* view;
 
-  vector<MPRegion*> regions;
+  vector<AutomationLane*> automation;
 
   char label[256];
 };
@@ -86,10 +104,635 @@ struct Project {
 };
 
 static Project active_project;
+
+// handle to a region in the region store. the generation of a slot changes
+// when its region is deleted, so old handles stop resolving instead of
+// pointing at whatever reuses the slot.
+struct RegionRef {
+  uint32_t slot;
+  uint32_t gen;
+};
+
+static const RegionRef NO_REGION = {0xffffffff, 0};
+
+enum region_flag_t {
+  RF_SELECTED = 1,
+  RF_FIRED = 2,   // fired in current loop? (Schedule, RT thread)
+  RF_STOPPED = 4  // note off sent in current loop? (Schedule, RT thread)
+};
+
+// interval index over rows sorted by inpoint: a tree holding the largest
+// inpoint and the largest length below each node, with the leaves at
+// leaves+row. no row below a node ends later than max_inpoint +
+// len_scale*max_length, for any len_scale>=0, so a tree serves the
+// scheduler's and the lanes' scale (see region_query()) whatever the tempo.
+struct EndTree {
+  uint32_t leaves;
+  vector<long> max_inpoint;
+  vector<long> max_length;
+  bool stale; // rows moved since it was built
+};
+
+static void end_tree_build(EndTree& e, const long* inpoint, const long* length, uint32_t n) {
+  uint32_t leaves = 1;
+  while (leaves<n) leaves *= 2;
+
+  e.leaves = leaves;
+  e.max_inpoint.assign(2*leaves, LONG_MIN);
+  e.max_length.assign(2*leaves, 0);
+  copy(inpoint, inpoint+n, e.max_inpoint.begin()+leaves);
+  copy(length, length+n, e.max_length.begin()+leaves);
+  for (uint32_t i=leaves-1; i>0; i--) {
+    e.max_inpoint[i] = max(e.max_inpoint[2*i], e.max_inpoint[2*i+1]);
+    e.max_length[i] = max(e.max_length[2*i], e.max_length[2*i+1]);
+  }
+  e.stale = false;
+}
+
+// O(log n) after the inpoint or length of one row changed
+static void end_tree_update(EndTree& e, uint32_t row, long inpoint, long length) {
+  uint32_t i = e.leaves+row;
+  e.max_inpoint[i] = inpoint;
+  e.max_length[i] = length;
+  for (i/=2; i>0; i/=2) {
+    e.max_inpoint[i] = max(e.max_inpoint[2*i], e.max_inpoint[2*i+1]);
+    e.max_length[i] = max(e.max_length[2*i], e.max_length[2*i+1]);
+  }
+}
+
+// appends the rows in [lo, hi) that end after from, a row ending at inpoint
+// + len_scale*length. a node is only entered if a row below it may end
+// after from; the bound is exact at the leaves. apart from the O(log n)
+// nodes along the edges of the range, nodes that lead to no result are
+// only entered because a long row shares them with rows that ended before
+// from.
+static void end_tree_query(const EndTree& e, uint32_t node, uint32_t nl, uint32_t nr, uint32_t lo, uint32_t hi, double from, double len_scale, vector<uint32_t>& out) {
+  if (nr<=lo || nl>=hi || e.max_inpoint[node] + len_scale*e.max_length[node]<=from) return;
+
+  if (nr-nl == 1) {
+    out.push_back(nl);
+    return;
+  }
+  uint32_t mid = (nl+nr)/2;
+  end_tree_query(e, 2*node, nl, mid, lo, hi, from, len_scale, out);
+  end_tree_query(e, 2*node+1, mid, nr, lo, hi, from, len_scale, out);
+}
+
+// all regions of the project as columns, one entry per row. rows are
+// grouped by track in track order and sorted by inpoint within a track, so
+// the scheduler, selection and lanes scan them linearly. rows move when
+// regions are added, moved or deleted; handles find them via the slots.
+struct RegionStore {
+  vector<uint32_t> id; // unique, saved with the project
+  vector<int> track_id;
+  vector<long> inpoint;
+  vector<long> length;
+  vector<int> instrument_id;
+  vector<uint8_t> flags;
+  vector<long> drag_inpoint; // inpoint when the current drag started
+  vector<uint32_t> slot;
+
+  vector<uint32_t> slot_row;
+  vector<uint32_t> slot_gen;
+  vector<uint32_t> free_slots;
+  unordered_map<uint32_t, uint32_t> id_slot;
+  uint32_t next_id;
+
+  // interval index. edits that move rows only mark it stale and the next
+  // query rebuilds it once, so adding or deleting many regions stays
+  // linear, like the column inserts themselves.
+  EndTree ends;
+
+  // handles of the rows flagged RF_SELECTED, so that selection edits
+  // don't scan the whole store
+  vector<RegionRef> selection;
+
+  // rows of track t are track_start[t] to track_start[t+1]
+  vector<uint32_t> track_start;
+
+  RegionStore(): next_id(1), track_start(1, 0) { ends.leaves = 0; ends.stale = true; }
+};
+
+static RegionStore region_store;
+
+uint32_t track_rows_begin(int t) {
+  RegionStore& s = region_store;
+  return (t>=0 && t+1<s.track_start.size()) ? s.track_start[t] : s.id.size();
+}
+
+uint32_t track_rows_end(int t) {
+  RegionStore& s = region_store;
+  return (t>=0 && t+1<s.track_start.size()) ? s.track_start[t+1] : s.id.size();
+}
+
+int region_row(RegionRef h) {
+  RegionStore& s = region_store;
+  if (h.slot>=s.slot_gen.size() || s.slot_gen[h.slot]!=h.gen) return -1;
+  return s.slot_row[h.slot];
+}
+
+RegionRef region_ref(uint32_t row) {
+  RegionStore& s = region_store;
+  RegionRef h = {s.slot[row], s.slot_gen[s.slot[row]]};
+  return h;
+}
+
+RegionRef region_by_id(uint32_t id) {
+  RegionStore& s = region_store;
+  unordered_map<uint32_t, uint32_t>::iterator it = s.id_slot.find(id);
+  if (it == s.id_slot.end()) return NO_REGION;
+  RegionRef h = {it->second, s.slot_gen[it->second]};
+  return h;
+}
+
+// undo history. while a step is open, the region functions below record
+// the state of a region the first time the step touches it, and
+// undo_end() adds the state after the edit. regions are matched by id and
+// refer to their track and instrument by pointer, so the deltas survive
+// the renumbering that track edits cause.
+struct RegionState {
+  uint32_t id;
+  Track* track;
+  Instrument* instrument;
+  long inpoint;
+  long length;
+};
+
+struct RegionDelta {
+  RegionState before;
+  RegionState after;
+  bool existed; // before the step
+  bool exists;  // after the step
+};
+
+// a track inserted into or removed from the track list
+struct TrackDelta {
+  Track* track;
+  Instrument* instrument;
+  int index;
+  bool removed;
+};
+
+struct UndoStep {
+  char name[32];
+  vector<TrackDelta> tracks; // in the order they happened
+  vector<RegionDelta> regions;
+  double bpm_before;
+  double bpm_after;
+};
+
+static UndoStep* undo_current = NULL;
+static bool undo_discard = false; // don't keep the current step
+static unordered_map<uint32_t, uint32_t> undo_touched; // region id -> delta in the current step
+
+static void region_state(uint32_t row, RegionState* st) {
+  RegionStore& s = region_store;
+  int t = s.track_id[row];
+  int iid = s.instrument_id[row];
+  st->id = s.id[row];
+  st->track = (t>=0 && t<active_project.tracks.size()) ? active_project.tracks[t] : NULL;
+  st->instrument = (iid>=0 && iid<active_project.instruments.size()) ? active_project.instruments[iid] : NULL;
+  st->inpoint = s.inpoint[row];
+  st->length = s.length[row];
+}
+
+static void undo_record(uint32_t id, int row) {
+  if (!undo_current || undo_discard || undo_touched.count(id)) return;
+
+  RegionDelta d;
+  d.before.id = id;
+  d.existed = row>=0;
+  if (d.existed) region_state(row, &d.before);
+  undo_touched[id] = undo_current->regions.size();
+  undo_current->regions.push_back(d);
+}
+
+static void end_tree_stale() {
+  region_store.ends.stale = true;
+}
+
+static void end_tree_update_row(uint32_t row) {
+  RegionStore& s = region_store;
+  if (!s.ends.stale) end_tree_update(s.ends, row, s.inpoint[row], s.length[row]);
+}
+
+// first row of track t with an inpoint after the given one
+static uint32_t track_insert_row(int t, long inpoint) {
+  RegionStore& s = region_store;
+  return upper_bound(s.inpoint.begin()+track_rows_begin(t), s.inpoint.begin()+track_rows_end(t), inpoint) - s.inpoint.begin();
+}
+
+static void insert_row(uint32_t row, uint32_t slot, uint32_t id, int t, long inpoint, long length, int instrument_id, uint8_t flags) {
+  RegionStore& s = region_store;
+  while (s.track_start.size()<t+2) s.track_start.push_back(s.id.size());
+
+  s.id.insert(s.id.begin()+row, id);
+  s.track_id.insert(s.track_id.begin()+row, t);
+  s.inpoint.insert(s.inpoint.begin()+row, inpoint);
+  s.length.insert(s.length.begin()+row, length);
+  s.instrument_id.insert(s.instrument_id.begin()+row, instrument_id);
+  s.flags.insert(s.flags.begin()+row, flags);
+  s.drag_inpoint.insert(s.drag_inpoint.begin()+row, inpoint);
+  s.slot.insert(s.slot.begin()+row, slot);
+
+  for (uint32_t i=row; i<s.slot.size(); i++) s.slot_row[s.slot[i]] = i;
+  for (uint32_t i=t+1; i<s.track_start.size(); i++) s.track_start[i]++;
+  end_tree_stale(); // rows after this one moved
+}
+
+static void erase_row(uint32_t row) {
+  RegionStore& s = region_store;
+  int t = s.track_id[row];
+
+  s.id.erase(s.id.begin()+row);
+  s.track_id.erase(s.track_id.begin()+row);
+  s.inpoint.erase(s.inpoint.begin()+row);
+  s.length.erase(s.length.begin()+row);
+  s.instrument_id.erase(s.instrument_id.begin()+row);
+  s.flags.erase(s.flags.begin()+row);
+  s.drag_inpoint.erase(s.drag_inpoint.begin()+row);
+  s.slot.erase(s.slot.begin()+row);
+
+  for (uint32_t i=row; i<s.slot.size(); i++) s.slot_row[s.slot[i]] = i;
+  for (uint32_t i=t+1; i<s.track_start.size(); i++) s.track_start[i]--;
+  end_tree_stale();
+}
+
+static void swap_rows(uint32_t a, uint32_t b) {
+  RegionStore& s = region_store;
+  swap(s.id[a], s.id[b]);
+  swap(s.inpoint[a], s.inpoint[b]);
+  swap(s.length[a], s.length[b]);
+  swap(s.instrument_id[a], s.instrument_id[b]);
+  swap(s.flags[a], s.flags[b]);
+  swap(s.drag_inpoint[a], s.drag_inpoint[b]);
+  swap(s.slot[a], s.slot[b]);
+  s.slot_row[s.slot[a]] = a;
+  s.slot_row[s.slot[b]] = b;
+  end_tree_update_row(a);
+  end_tree_update_row(b);
+}
+
+// id 0 or an id that is already taken (older projects saved every region
+// as 1) gets a fresh one
+static uint32_t region_new_id(uint32_t id) {
+  RegionStore& s = region_store;
+  if (!id || s.id_slot.count(id)) id = s.next_id;
+  if (id>=s.next_id) s.next_id = id+1;
+  return id;
+}
+
+static uint32_t region_new_slot() {
+  RegionStore& s = region_store;
+  if (s.free_slots.size()) {
+    uint32_t slot = s.free_slots.back();
+    s.free_slots.pop_back();
+    return slot;
+  }
+  s.slot_gen.push_back(0);
+  s.slot_row.push_back(0);
+  return s.slot_gen.size()-1;
+}
+
+RegionRef region_add(int t, long inpoint, long length, int instrument_id, uint32_t id) {
+  RegionStore& s = region_store;
+  id = region_new_id(id);
+  uint32_t slot = region_new_slot();
+  s.id_slot[id] = slot;
+
+  insert_row(track_insert_row(t, inpoint), slot, id, t, inpoint, length, instrument_id, 0);
+  undo_record(id, -1);
+  return region_ref(s.slot_row[slot]);
+}
+
+void region_deselect(RegionRef h);
+
+void region_delete(RegionRef h) {
+  RegionStore& s = region_store;
+  int row = region_row(h);
+  if (row<0) return;
+
+  undo_record(s.id[row], row);
+  region_deselect(h);
+
+  s.id_slot.erase(s.id[row]);
+  s.slot_gen[h.slot]++;
+  s.free_slots.push_back(h.slot);
+  erase_row(row);
+}
+
+void region_select(RegionRef h) {
+  RegionStore& s = region_store;
+  int row = region_row(h);
+  if (row<0 || (s.flags[row]&RF_SELECTED)) return;
+
+  s.flags[row] |= RF_SELECTED;
+  s.selection.push_back(h);
+}
+
+void region_deselect(RegionRef h) {
+  RegionStore& s = region_store;
+  int row = region_row(h);
+  if (row<0 || !(s.flags[row]&RF_SELECTED)) return;
+
+  s.flags[row] &= ~RF_SELECTED;
+  for (int i=0; i<s.selection.size(); i++) {
+    if (s.selection[i].slot == h.slot) {
+      s.selection[i] = s.selection.back();
+      s.selection.pop_back();
+      break;
+    }
+  }
+}
+
+// keeps the rows of the track sorted; drags move regions a short way, so
+// the row is bubbled to its new place
+void region_set_inpoint(RegionRef h, long inpoint) {
+  RegionStore& s = region_store;
+  int row = region_row(h);
+  if (row<0) return;
+
+  undo_record(s.id[row], row);
+  int t = s.track_id[row];
+  s.inpoint[row] = inpoint;
+  while (row>track_rows_begin(t) && s.inpoint[row-1]>inpoint) {
+    swap_rows(row-1, row);
+    row--;
+  }
+  while (row+1<track_rows_end(t) && s.inpoint[row+1]<inpoint) {
+    swap_rows(row, row+1);
+    row++;
+  }
+  end_tree_update_row(row);
+}
+
+void region_set_length(RegionRef h, long length) {
+  RegionStore& s = region_store;
+  int row = region_row(h);
+  if (row<0) return;
+
+  undo_record(s.id[row], row);
+  s.length[row] = length;
+  end_tree_update_row(row);
+}
+
+void region_set_track(RegionRef h, int t) {
+  RegionStore& s = region_store;
+  int row = region_row(h);
+  if (row<0 || s.track_id[row]==t) return;
+
+  undo_record(s.id[row], row);
+  uint32_t id = s.id[row];
+  long inpoint = s.inpoint[row];
+  long length = s.length[row];
+  int instrument_id = s.instrument_id[row];
+  uint8_t flags = s.flags[row];
+  long drag_inpoint = s.drag_inpoint[row];
+
+  erase_row(row);
+  insert_row(track_insert_row(t, inpoint), h.slot, id, t, inpoint, length, instrument_id, flags);
+  s.drag_inpoint[s.slot_row[h.slot]] = drag_inpoint;
+}
+
+// a region to be placed by region_store_apply()
+struct RegionRow {
+  RegionRef h; // region to move, NO_REGION to add a new one
+  uint32_t id;
+  int track;
+  long inpoint;
+  long length;
+  int instrument_id;
+};
+
+static bool region_row_before(const RegionRow& a, const RegionRow& b) {
+  return a.track<b.track || (a.track==b.track && a.inpoint<b.inpoint);
+}
+
+// track_start from the track_id column, keeping at least the tracks it had
+static void track_start_rebuild(int num_tracks) {
+  RegionStore& s = region_store;
+  if (s.id.size() && s.track_id.back()+1>num_tracks) num_tracks = s.track_id.back()+1;
+
+  s.track_start.resize(num_tracks+1);
+  for (int t=0; t<=num_tracks; t++) {
+    s.track_start[t] = lower_bound(s.track_id.begin(), s.track_id.end(), t) - s.track_id.begin();
+  }
+}
+
+// many edits in one pass over the columns instead of moving the rows after
+// every single one: deletes the regions in kill and places the rows in put,
+// moving existing regions or adding new ones (ids as in region_add()). rows
+// put at the same inpoint as existing ones go after them, in the order
+// given. O(n + k log k) for k edits.
+void region_store_apply(const vector<RegionRef>& kill, vector<RegionRow>& put) {
+  RegionStore& s = region_store;
+  uint32_t n = s.id.size();
+  vector<uint8_t> gone(n, 0);
+  vector<uint8_t> put_flags(put.size(), 0);
+  bool deselected = false;
+
+  for (RegionRef h : kill) {
+    int row = region_row(h);
+    if (row<0 || gone[row]) continue;
+    undo_record(s.id[row], row);
+    if (s.flags[row]&RF_SELECTED) deselected = true;
+    s.id_slot.erase(s.id[row]);
+    s.slot_gen[h.slot]++;
+    s.free_slots.push_back(h.slot);
+    gone[row] = 1;
+  }
+
+  for (int i=0; i<put.size(); i++) {
+    RegionRow& p = put[i];
+    int row = region_row(p.h);
+    if (row>=0 && !gone[row]) {
+      undo_record(s.id[row], row);
+      p.id = s.id[row];
+      put_flags[i] = s.flags[row];
+      gone[row] = 1;
+    } else {
+      p.id = region_new_id(p.id);
+      p.h.slot = region_new_slot();
+      s.id_slot[p.id] = p.h.slot;
+      undo_record(p.id, -1);
+    }
+  }
+
+  // the surviving rows and the sorted new ones are merged into new columns
+  vector<uint32_t> order(put.size());
+  for (uint32_t i=0; i<order.size(); i++) order[i] = i;
+  stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return region_row_before(put[a], put[b]); });
+
+  RegionStore m;
+  uint32_t total = n+put.size();
+  m.id.reserve(total);
+  m.track_id.reserve(total);
+  m.inpoint.reserve(total);
+  m.length.reserve(total);
+  m.instrument_id.reserve(total);
+  m.flags.reserve(total);
+  m.drag_inpoint.reserve(total);
+  m.slot.reserve(total);
+
+  uint32_t k = 0;
+  for (uint32_t row=0; row<=n; row++) {
+    if (row<n && gone[row]) continue;
+    // new rows go before the next surviving row that sorts after them
+    while (k<order.size()) {
+      RegionRow& p = put[order[k]];
+      if (row<n && (s.track_id[row]<p.track || (s.track_id[row]==p.track && s.inpoint[row]<=p.inpoint))) break;
+      m.id.push_back(p.id);
+      m.track_id.push_back(p.track);
+      m.inpoint.push_back(p.inpoint);
+      m.length.push_back(p.length);
+      m.instrument_id.push_back(p.instrument_id);
+      m.flags.push_back(put_flags[order[k]]);
+      m.drag_inpoint.push_back(p.inpoint);
+      m.slot.push_back(p.h.slot);
+      k++;
+    }
+    if (row==n) break;
+    m.id.push_back(s.id[row]);
+    m.track_id.push_back(s.track_id[row]);
+    m.inpoint.push_back(s.inpoint[row]);
+    m.length.push_back(s.length[row]);
+    m.instrument_id.push_back(s.instrument_id[row]);
+    m.flags.push_back(s.flags[row]);
+    m.drag_inpoint.push_back(s.drag_inpoint[row]);
+    m.slot.push_back(s.slot[row]);
+  }
+
+  s.id.swap(m.id);
+  s.track_id.swap(m.track_id);
+  s.inpoint.swap(m.inpoint);
+  s.length.swap(m.length);
+  s.instrument_id.swap(m.instrument_id);
+  s.flags.swap(m.flags);
+  s.drag_inpoint.swap(m.drag_inpoint);
+  s.slot.swap(m.slot);
+
+  for (uint32_t row=0; row<s.slot.size(); row++) s.slot_row[s.slot[row]] = row;
+  track_start_rebuild(s.track_start.size()-1);
+  end_tree_stale();
+
+  if (deselected) {
+    int kept = 0;
+    for (RegionRef h : s.selection) {
+      if (region_row(h)>=0) s.selection[kept++] = h;
+    }
+    s.selection.resize(kept);
+  }
+}
+
+// appends the rows of track t that overlap [from, to) in region units, in
+// inpoint order. a region ends at inpoint + len_scale*length: the
+// scheduler counts lengths half (see jack_process_callback, it queries its
+// own copy of the rows), lanes scale them with the tempo. O(log n) per result.
+void region_query(int t, double from, double to, double len_scale, vector<uint32_t>& out) {
+  RegionStore& s = region_store;
+  uint32_t lo = track_rows_begin(t);
+  uint32_t hi = track_rows_end(t);
+  if (lo>=hi) return;
+
+  if (s.ends.stale) end_tree_build(s.ends, s.inpoint.data(), s.length.data(), s.id.size());
+
+  // rows starting at or after to are out
+  long last_start = (long)::ceil(to)-1;
+  hi = upper_bound(s.inpoint.begin()+lo, s.inpoint.begin()+hi, last_start) - s.inpoint.begin();
+  end_tree_query(s.ends, 1, 0, s.ends.leaves, lo, hi, from, len_scale, out);
+}
+
+// makes room for a new track t; the rows of t and later tracks move down one track
+void region_store_insert_track(int t) {
+  RegionStore& s = region_store;
+  if (t<0 || t+1>=s.track_start.size()) return; // no rows at or after t
+
+  for (uint32_t i=s.track_start[t]; i<s.id.size(); i++) {
+    s.track_id[i]++;
+  }
+  s.track_start.insert(s.track_start.begin()+t, s.track_start[t]);
+}
+
+// deletes the regions of track t; the rows of later tracks move up one track
+void region_store_remove_track(int t) {
+  RegionStore& s = region_store;
+  if (t<0 || t+1>=s.track_start.size()) return;
+
+  vector<RegionRef> kill;
+  for (uint32_t i=track_rows_begin(t); i<track_rows_end(t); i++) {
+    kill.push_back(region_ref(i));
+  }
+  vector<RegionRow> none;
+  region_store_apply(kill, none);
+
+  for (uint32_t i=track_rows_end(t); i<s.id.size(); i++) {
+    s.track_id[i]--;
+  }
+  s.track_start.erase(s.track_start.begin()+t+1);
+}
+
+// fills the empty store with whole columns, e.g. from a project file:
+// counts[t] rows for each track t, sorted by inpoint within a track.
+// ids follow the rules of region_add().
+void region_store_assign(const uint32_t* counts, int num_tracks, const uint32_t* id, const int32_t* instrument_id, const int64_t* inpoint, const int64_t* length) {
+  RegionStore& s = region_store;
+  if (s.id.size()) return;
+
+  s.track_start.assign(1, 0);
+  for (int t=0; t<num_tracks; t++) s.track_start.push_back(s.track_start[t]+counts[t]);
+  uint32_t n = s.track_start[num_tracks];
+
+  s.id.resize(n);
+  s.track_id.resize(n);
+  s.inpoint.assign(inpoint, inpoint+n);
+  s.length.assign(length, length+n);
+  s.instrument_id.assign(instrument_id, instrument_id+n);
+  s.flags.assign(n, 0);
+  s.drag_inpoint.assign(inpoint, inpoint+n);
+  s.slot.resize(n);
+  s.id_slot.reserve(n);
+
+  for (int t=0; t<num_tracks; t++) {
+    for (uint32_t r=s.track_start[t]; r<s.track_start[t+1]; r++) s.track_id[r] = t;
+  }
+
+  for (uint32_t r=0; r<n; r++) {
+    uint32_t rid = region_new_id(id[r]);
+    uint32_t slot = region_new_slot();
+    s.id[r] = rid;
+    s.slot[r] = slot;
+    s.slot_row[slot] = r;
+    s.id_slot[rid] = slot;
+  }
+  end_tree_stale();
+}
+
+// empties the store in one go. every handle goes stale; ids are not reused.
+void region_store_clear() {
+  RegionStore& s = region_store;
+  s.id.clear();
+  s.track_id.clear();
+  s.inpoint.clear();
+  s.length.clear();
+  s.instrument_id.clear();
+  s.flags.clear();
+  s.drag_inpoint.clear();
+  s.slot.clear();
+
+  s.free_slots.clear();
+  for (uint32_t slot=0; slot<s.slot_gen.size(); slot++) {
+    s.slot_gen[slot]++;
+    s.free_slots.push_back(slot);
+  }
+  s.id_slot.clear();
+  s.selection.clear();
+  s.track_start.assign(1, 0);
+  end_tree_stale();
+}
+
 static int playback_enabled = 0;
 static int bounce_enabled = 0;
 #define QUANTUM_NANOSEC 10000L
-static int running = 1;
 
 #include <stdio.h>
 #include <jack/jack.h>
@@ -98,9 +741,13 @@ static int running = 1;
 
 #define MIDI_NOTE_ON		0x90
 #define MIDI_NOTE_OFF		0x80
+#define MIDI_CONTROL_CHANGE	0xb0
+#define MIDI_PROGRAM_CHANGE	0xc0
+#define MIDI_PITCH_BEND		0xe0
 
 #define NUM_MIDI_PORTS  8
 #define MAX_MIDI_QUEUE_LEN 64
+#define MAX_AUTOMATION_QUEUE_LEN 512
 
 #define NUM_AUDIO_PORTS  16
 
@@ -116,6 +763,7 @@ jack_client_t	*jack_client = NULL;
 
 struct MidiMessage {
   jack_nframes_t time;
+  int port;
   int len;
   unsigned char data[3];
 };
@@ -128,39 +776,107 @@ struct MidiEvent {
   int velocity;
 };
 
+// automation events of the current period; flushed after the notes
+// because jack wants the events of a port buffer in time order
+static MidiMessage automation_queue[MAX_AUTOMATION_QUEUE_LEN];
+static int automation_queued = 0;
+static std::atomic<uint32_t> automation_dropped(0); // events lost to a full queue
+
+// thinning: automation is sampled at most every automation_min_frames
+// and only sent when the value moved by at least automation_min_delta
+static int automation_min_frames = 64;
+static int automation_min_delta = 1;
+
+// channels are numbered 1-16 like on the synths; 0 (the old default) is channel 1
+static inline unsigned char midi_channel_bits(int channel) {
+  if (channel<1) return 0;
+  return (channel-1)&0x0f;
+}
+
+void write_midi_message(MidiMessage* ev) {
+  if (ev->port<0 || ev->port>=NUM_MIDI_PORTS) return;
+  
+  void* port_buffer = midi_port_buffers[ev->port];
+
+  if (port_buffer == NULL) {
+    printf("jack_port_get_buffer failed, cannot send anything.\n");
+    return;
+  }
+  
+  unsigned char* buffer = jack_midi_event_reserve(port_buffer, ev->time, ev->len);
+  if (buffer == NULL) {
+    printf("jack_midi_event_reserve failed, MIDI EVENT LOST.\n");
+    return;
+  }
+  memcpy(buffer, ev->data, ev->len);
+}
 
 void send_midi(int note, int note_on, int port, char channel, int velocity) {
-  unsigned char  *buffer;
-  jack_nframes_t	last_frame_time;
   struct MidiMessage ev;
 
-  channel = 0;
-
-  void* port_buffer = midi_port_buffers[port];
-
+  ev.time = 0;
+  ev.port = port;
   ev.len = 3;
 
   printf("send_midi: %d %d %d %d %d\n",note,note_on,port,channel,velocity);
   
   if (note_on) {
-    ev.data[0] = MIDI_NOTE_ON + channel;
+    ev.data[0] = MIDI_NOTE_ON + midi_channel_bits(channel);
   } else {
-    ev.data[0] = MIDI_NOTE_OFF + channel;
+    ev.data[0] = MIDI_NOTE_OFF + midi_channel_bits(channel);
   }
   ev.data[1] = note; // c3
   ev.data[2] = velocity; // velocity
 
-  if (port_buffer == NULL) {
-    printf("jack_port_get_buffer failed, cannot send anything.\n");
+  write_midi_message(&ev);
+}
+
+void queue_automation_midi(AutomationLane* lane, int value, jack_nframes_t time, int port, int channel) {
+  if (automation_queued>=MAX_AUTOMATION_QUEUE_LEN) {
+    automation_dropped.fetch_add(1, std::memory_order_relaxed);
     return;
   }
+
+  MidiMessage* ev = &automation_queue[automation_queued++];
+  ev->time = time;
+  ev->port = port;
+
+  unsigned char ch = midi_channel_bits(channel);
   
-  buffer = jack_midi_event_reserve(port_buffer, 0, ev.len);
-  if (buffer == NULL) {
-    printf("jack_midi_event_reserve (1) failed, NOTE ON LOST.\n");
-    return;
+  if (lane->type == A_CC) {
+    ev->len = 3;
+    ev->data[0] = MIDI_CONTROL_CHANGE + ch;
+    ev->data[1] = lane->controller&0x7f;
+    ev->data[2] = value&0x7f;
+  } else if (lane->type == A_PITCH_BEND) {
+    ev->len = 3;
+    ev->data[0] = MIDI_PITCH_BEND + ch;
+    ev->data[1] = value&0x7f; // lsb
+    ev->data[2] = (value>>7)&0x7f; // msb
+  } else {
+    ev->len = 2;
+    ev->data[0] = MIDI_PROGRAM_CHANGE + ch;
+    ev->data[1] = value&0x7f;
+  }
+}
+
+void flush_automation_queue() {
+  // insertion sort by time; the queue is short thanks to thinning
+  // and mostly sorted already (lanes are rendered in time order)
+  for (int i=1; i<automation_queued; i++) {
+    MidiMessage ev = automation_queue[i];
+    int j = i-1;
+    while (j>=0 && automation_queue[j].time>ev.time) {
+      automation_queue[j+1] = automation_queue[j];
+      j--;
+    }
+    automation_queue[j+1] = ev;
+  }
+  
+  for (int i=0; i<automation_queued; i++) {
+    write_midi_message(&automation_queue[i]);
   }
-  memcpy(buffer, ev.data, 3);
+  automation_queued = 0;
 }
 
 static double playhead = 0;
@@ -169,8 +885,9 @@ static double playhead = 0;
 static double bpm = 120.0; 
 #define TMUL 1000000.0
 
-static double loop_start_point = 0;
-static double loop_end_point = 1000;
+// region units
+static long loop_start_point = 0;
+static long loop_end_point = 1000;
 
 double playhead_samples = 0;
 
@@ -181,26 +898,292 @@ void set_playhead(double ph) {
   playhead_samples = playhead/TMUL*48.0;
 }
 
-void do_playback_cleanup() {
-  int audio_port_idx = 0;
-  int ti = 0;
-  for (Track* t : active_project.tracks) {
-    float* audio_out = NULL;
-      
-    Instrument* default_instr = active_project.instruments[ti];
-    
-    for (MPRegion* r : t->regions) {
-      if (r->fired && !r->stopped) {
-        Instrument* instr = active_project.instruments[r->instrument_id];
-        if (instr->type == I_MIDI) {
-          send_midi(instr->note,0,instr->midi_port,instr->midi_channel,127);
+// playhead at the start of the current period, published by the RT thread
+// so the GUI can extrapolate the position at draw time instead of reading
+// playhead while it is written. odd sequence numbers mark a write in
+// progress (seqlock); the RT thread never waits.
+static std::atomic<uint32_t> playhead_stamp_seq(0);
+static std::atomic<jack_nframes_t> playhead_stamp_frame(0);
+static std::atomic<double> playhead_stamp_pos(0);
+static std::atomic<int> playhead_stamp_rolling(0);
+
+// RT thread only
+static void publish_playhead(jack_nframes_t frame, int rolling) {
+  uint32_t seq = playhead_stamp_seq.load(std::memory_order_relaxed);
+  playhead_stamp_seq.store(seq+1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  playhead_stamp_frame.store(frame, std::memory_order_relaxed);
+  playhead_stamp_pos.store(playhead, std::memory_order_relaxed);
+  playhead_stamp_rolling.store(rolling, std::memory_order_relaxed);
+  playhead_stamp_seq.store(seq+2, std::memory_order_release);
+}
+
+// current playhead as seen by the GUI thread
+double playhead_now() {
+  if (!jack_client || !playback_enabled) return playhead; // not written by the RT thread
+
+  uint32_t seq;
+  jack_nframes_t frame;
+  double pos;
+  int rolling;
+  do {
+    seq = playhead_stamp_seq.load(std::memory_order_acquire);
+    frame = playhead_stamp_frame.load(std::memory_order_relaxed);
+    pos = playhead_stamp_pos.load(std::memory_order_relaxed);
+    rolling = playhead_stamp_rolling.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq&1) || seq!=playhead_stamp_seq.load(std::memory_order_relaxed));
+
+  if (!rolling) return pos;
+
+  // frame counters wrap, the difference doesn't care
+  int32_t elapsed = (int32_t)(jack_frame_time(jack_client)-frame);
+  if (elapsed<0) elapsed = 0;
+  return pos + TMUL*((double)elapsed/48.0);
+}
+
+// what the RT thread plays: a copy of the tracks, regions and automation
+// lanes that the GUI thread publishes after edits, see schedule_update().
+// the RT thread only writes the playback flags and lane state in it. a schedule is handed over through
+// schedule_next and comes back through schedule_retired once the RT thread
+// has switched to a newer one. the GUI thread only frees it then and only
+// publishes again after the last one was taken, so the RT thread never
+// waits, allocates or frees.
+struct ScheduleTrack {
+  Track* track;
+  Instrument* instrument; // default instrument of the track, may be NULL
+  uint32_t rows_begin;
+  uint32_t rows_end;
+  uint32_t lanes_begin;
+  uint32_t lanes_end;
+};
+
+struct Schedule {
+  vector<ScheduleTrack> tracks;
+
+  // region rows in store order
+  vector<long> inpoint;
+  vector<long> length;
+  vector<Instrument*> instrument;
+  vector<uint32_t> slot; // slot and generation identify a region across schedules
+  vector<uint32_t> gen;
+  vector<uint8_t> flags; // RF_FIRED, RF_STOPPED; RT thread only
+
+  // relative to the schedule the RT thread played before this one
+  vector<int32_t> prev_row; // row of the same region there, -1 if it is new
+  vector<uint32_t> dropped; // rows there whose regions are gone
+
+  EndTree ends; // queried with lengths counting half
+  vector<uint32_t> found; // rows found by the scheduler, room for all of them
+
+  vector<AutomationLane> lanes;
+  vector<int32_t> prev_lane; // same track, type and controller there, -1 if new
+};
+
+static std::atomic<Schedule*> schedule_next(NULL);
+static std::atomic<Schedule*> schedule_retired(NULL);
+static Schedule* schedule_rt = NULL;   // RT thread
+static Schedule* schedule_last = NULL; // GUI thread, the last one published
+static bool schedule_stale = true;     // GUI thread, edited since
+
+// GUI thread, once per frame: publishes the project to the RT thread if it
+// was edited and the RT thread took the last schedule
+void schedule_update() {
+  if (!schedule_stale || schedule_next.load(std::memory_order_acquire)) return;
+  delete schedule_retired.exchange(NULL, std::memory_order_acquire);
+
+  RegionStore& rs = region_store;
+  Project& p = active_project;
+  Schedule* sc = new Schedule;
+  uint32_t n = rs.id.size();
+
+  for (int i=0; i<p.tracks.size(); i++) {
+    ScheduleTrack st = {p.tracks[i], i<p.instruments.size() ? p.instruments[i] : NULL, track_rows_begin(i), track_rows_end(i)};
+    st.lanes_begin = sc->lanes.size();
+    for (AutomationLane* lane : p.tracks[i]->automation) {
+      sc->lanes.push_back(*lane);
+      AutomationLane& copy = sc->lanes.back();
+      copy.cursor = 0;
+      copy.last_value = -1;
+      copy.last_sent_smp = 0;
+    }
+    st.lanes_end = sc->lanes.size();
+    sc->tracks.push_back(st);
+  }
+  sc->prev_lane.assign(sc->lanes.size(), -1);
+
+  sc->inpoint = rs.inpoint;
+  sc->length = rs.length;
+  sc->slot = rs.slot;
+  sc->instrument.resize(n);
+  sc->gen.resize(n);
+  sc->flags.assign(n, 0);
+  sc->prev_row.assign(n, -1);
+  for (uint32_t r=0; r<n; r++) {
+    int iid = rs.instrument_id[r];
+    sc->instrument[r] = (iid>=0 && iid<p.instruments.size()) ? p.instruments[iid] : NULL;
+    sc->gen[r] = rs.slot_gen[rs.slot[r]];
+  }
+
+  // the RT thread plays the last schedule now, it took it
+  Schedule* last = schedule_last;
+  if (last) {
+    vector<int32_t> slot_prev(rs.slot_gen.size(), -1);
+    vector<uint8_t> kept(last->slot.size(), 0);
+    for (uint32_t j=0; j<last->slot.size(); j++) slot_prev[last->slot[j]] = j;
+    for (uint32_t r=0; r<n; r++) {
+      int32_t j = slot_prev[sc->slot[r]];
+      if (j>=0 && last->gen[j]==sc->gen[r]) {
+        sc->prev_row[r] = j;
+        kept[j] = 1;
+      }
+    }
+    for (uint32_t j=0; j<last->slot.size(); j++) {
+      if (!kept[j]) sc->dropped.push_back(j);
+    }
+
+    unordered_map<Track*, ScheduleTrack*> last_tracks;
+    for (ScheduleTrack& lt : last->tracks) last_tracks[lt.track] = &lt;
+    for (ScheduleTrack& st : sc->tracks) {
+      unordered_map<Track*, ScheduleTrack*>::iterator it = last_tracks.find(st.track);
+      if (it == last_tracks.end()) continue;
+      for (uint32_t k=st.lanes_begin; k<st.lanes_end; k++) {
+        AutomationLane& lane = sc->lanes[k];
+        for (uint32_t j=it->second->lanes_begin; j<it->second->lanes_end; j++) {
+          if (last->lanes[j].type == lane.type && last->lanes[j].controller == lane.controller) {
+            sc->prev_lane[k] = j;
+            break;
+          }
         }
       }
-      r->fired = false;
-      r->stopped = false;
     }
+  }
+
+  sc->found.reserve(n);
+  end_tree_build(sc->ends, sc->inpoint.data(), sc->length.data(), n);
+
+  schedule_last = sc;
+  schedule_stale = false;
+  schedule_next.store(sc, std::memory_order_release);
+}
+
+// RT thread: switches to a newly published schedule, keeping the playback
+// state of the regions that are still there
+static void schedule_take() {
+  Schedule* next = schedule_next.load(std::memory_order_acquire);
+  if (!next) return;
+
+  Schedule* old = schedule_rt;
+  if (old) {
+    for (uint32_t r=0; r<next->flags.size(); r++) {
+      if (next->prev_row[r]>=0) next->flags[r] = old->flags[next->prev_row[r]];
+    }
+    // deleted while sounding
+    for (uint32_t j : next->dropped) {
+      Instrument* instr = old->instrument[j];
+      if ((old->flags[j]&(RF_FIRED|RF_STOPPED)) == RF_FIRED && instr && instr->type == I_MIDI) {
+        send_midi(instr->note,0,instr->midi_port,instr->midi_channel,127);
+      }
+    }
+    for (uint32_t k=0; k<next->lanes.size(); k++) {
+      if (next->prev_lane[k]<0) continue;
+      AutomationLane& lane = next->lanes[k];
+      AutomationLane& prev = old->lanes[next->prev_lane[k]];
+      lane.cursor = prev.cursor;
+      lane.last_value = prev.last_value;
+      lane.last_sent_smp = prev.last_sent_smp;
+    }
+  }
+  schedule_rt = next;
+  // retired before next is cleared, see schedule_update()
+  schedule_retired.store(old, std::memory_order_release);
+  schedule_next.store(NULL, std::memory_order_release);
+}
+
+// RT thread
+void do_playback_cleanup() {
+  Schedule* sc = schedule_rt;
+  if (!sc) return;
+
+  for (uint32_t r=0; r<sc->flags.size(); r++) {
+    Instrument* instr = sc->instrument[r];
+    if ((sc->flags[r]&(RF_FIRED|RF_STOPPED)) == RF_FIRED && instr && instr->type == I_MIDI) {
+      send_midi(instr->note,0,instr->midi_port,instr->midi_channel,127);
+    }
+    sc->flags[r] = 0;
+  }
+
+  for (AutomationLane& lane : sc->lanes) {
+    lane.cursor = 0;
+    lane.last_value = -1;
+  }
+}
+
+// value of an automation lane at time t (region units).
+// lane->cursor only moves forward during playback; it is re-seeked
+// with a binary search if the playhead jumped backwards.
+int automation_value_at(AutomationLane* lane, double t) {
+  int n = lane->times.size();
+  if (!n) return -1;
+
+  int c = lane->cursor;
+  if (c>n || (c>0 && lane->times[c-1]>t)) {
+    c = upper_bound(lane->times.begin(), lane->times.end(), (int32_t)t) - lane->times.begin();
+  }
+  while (c<n && lane->times[c]<=t) c++;
+  lane->cursor = c;
+
+  if (c==0) return lane->values[0];
+  if (c==n || lane->type == A_PROGRAM) return lane->values[c-1];
+
+  double t0 = lane->times[c-1];
+  double t1 = lane->times[c];
+  double v0 = lane->values[c-1];
+  double v1 = lane->values[c];
+  
+  return (int)round(v0 + (v1-v0)*(t-t0)/(t1-t0));
+}
+
+// RT thread: the lanes of st in the schedule sc
+void render_automation(Schedule* sc, ScheduleTrack& st, Instrument* instr, jack_nframes_t nframes, double bpm_factor) {
+  double smp_per_unit = bpm_factor*48.0;
+  
+  for (uint32_t k=st.lanes_begin; k<st.lanes_end; k++) {
+    AutomationLane* lane = &sc->lanes[k];
+    int n = lane->times.size();
+    if (!n) continue;
+    // the playhead jumped back: start over, as after a loop
+    if (lane->last_value>=0 && lane->last_sent_smp>playhead_samples) {
+      lane->cursor = 0;
+      lane->last_value = -1;
+      lane->last_sent_smp = 0;
+    }
+    // past the last breakpoint and already there, nothing to do
+    if (lane->cursor>=n && lane->last_value == lane->values[n-1]) continue;
 
-    ti++;
+    int min_delta = automation_min_delta;
+    if (lane->type == A_PITCH_BEND) min_delta *= 64; // 14 bit values
+    if (min_delta<1) min_delta = 1;
+
+    int step = automation_min_frames;
+    if (step<1) step = 1;
+
+    double f = 0;
+    if (lane->last_value>=0) {
+      f = lane->last_sent_smp + automation_min_frames - playhead_samples;
+      if (f<0) f = 0;
+    }
+    
+    for (; f<nframes; f+=step) {
+      int v = automation_value_at(lane, (playhead_samples+f)/smp_per_unit);
+      
+      if (lane->last_value<0 || abs(v-lane->last_value)>=min_delta
+          || (v!=lane->last_value && v==lane->values[n-1] && lane->cursor>=n)) {
+        queue_automation_midi(lane, v, (jack_nframes_t)f, instr->midi_port, instr->midi_channel);
+        lane->last_value = v;
+        lane->last_sent_smp = playhead_samples+f;
+      }
+    }
   }
 }
 
@@ -209,6 +1192,8 @@ int jack_process_callback(jack_nframes_t nframes, void *notused)
   for (int i=0; i<NUM_MIDI_PORTS; i++) {
     jack_midi_clear_buffer(midi_port_buffers[i]);
   }
+  schedule_take();
+  Schedule* sc = schedule_rt;
 
   //printf("out buffer: %p\n",out);
   // playhead is in nanoseconds (?)
@@ -216,30 +1201,28 @@ int jack_process_callback(jack_nframes_t nframes, void *notused)
   double bpm_factor = 240.0/bpm; // 2
   double delta_ns = TMUL*((double)nframes/48.0); // how many ns passed?
 
-  if (playback_clean_up) {
+  if (playback_clean_up && sc) {
     playback_clean_up = 0;
     do_playback_cleanup();
 
     // clear audio buffers
-    int ti = 0;
     int audio_port_idx = 0;
-    for (Track* t : active_project.tracks) {
+    for (ScheduleTrack& st : sc->tracks) {
       float* audio_out = NULL;
       
-      Instrument* default_instr = active_project.instruments[ti];
+      Instrument* default_instr = st.instrument;
 
-      if (default_instr->type == I_SAMPLE) {
+      if (default_instr && default_instr->type == I_SAMPLE) {
         // clear all the buffers
         audio_out = (float*)jack_port_get_buffer(audio_output_ports[audio_port_idx], nframes);
         memset(audio_out, 0, nframes*sizeof(float));
         
         audio_port_idx = (audio_port_idx+1)%NUM_AUDIO_PORTS;
       }
-      ti++;
     }
   }
   
-  if (playback_enabled) {
+  if (playback_enabled && sc) {
     if (playhead>loop_end_point*bpm_factor*TMUL) {
       set_playhead(loop_start_point*bpm_factor*TMUL);
       
@@ -256,15 +1239,15 @@ int jack_process_callback(jack_nframes_t nframes, void *notused)
       }
     }
 
+    publish_playhead(jack_last_frame_time(jack_client), 1);
+
     int audio_port_idx = 0;
-    int ti = 0;
 
-    for (Track* t : active_project.tracks) {
+    for (ScheduleTrack& st : sc->tracks) {
       float* audio_out = NULL;
+      Instrument* default_instr = st.instrument;
 
-      if (active_project.instruments.size()>ti) {
-        Instrument* default_instr = active_project.instruments[ti];
-
+      if (default_instr) {
         if (default_instr->type == I_SAMPLE) {
           audio_out = (float*)jack_port_get_buffer(audio_output_ports[audio_port_idx], nframes);
           memset(audio_out, 0, nframes*sizeof(float));
@@ -273,26 +1256,36 @@ int jack_process_callback(jack_nframes_t nframes, void *notused)
         }
       }
       
-      for (MPRegion* r : t->regions) {
-        double rstart = (long)r->inpoint * TMUL * bpm_factor;
-        double rstop  = rstart + ((long)r->length/2 * TMUL * bpm_factor); // FIXME: why is /2 correct?!?
+      // regions around this period. one period back for note offs that
+      // are due now, one ahead for samples starting inside the buffer.
+      double unit_ns = TMUL*bpm_factor;
+      double from = (playhead-delta_ns)/unit_ns-1;
+      double to = (playhead+2*delta_ns)/unit_ns+1;
+      uint32_t hi = upper_bound(sc->inpoint.begin()+st.rows_begin, sc->inpoint.begin()+st.rows_end, (long)::ceil(to)-1) - sc->inpoint.begin();
+      sc->found.clear();
+      end_tree_query(sc->ends, 1, 0, sc->ends.leaves, st.rows_begin, hi, from, 0.5, sc->found);
+
+      for (uint32_t r : sc->found) {
+        double rstart = sc->inpoint[r] * TMUL * bpm_factor;
+        double rstop  = rstart + (sc->length[r]/2 * TMUL * bpm_factor); // FIXME: why is /2 correct?!?
 
         double rstart_smp = (rstart*48.0)/TMUL;
         double rstop_smp = (rstop*48.0)/TMUL;
+        uint8_t& flags = sc->flags[r];
         
-        if (active_project.instruments.size()<=r->instrument_id) {
-          printf("error: track has non-existing instrument id %d\n",r->instrument_id);
+        if (!sc->instrument[r]) {
+          printf("error: region %d has no instrument\n",r);
         } else {
           
-          Instrument* instr = active_project.instruments[r->instrument_id];
+          Instrument* instr = sc->instrument[r];
 
-          if (r->fired && !r->stopped && playhead>=rstop) {
-            r->stopped = true;
+          if ((flags&(RF_FIRED|RF_STOPPED)) == RF_FIRED && playhead>=rstop) {
+            flags |= RF_STOPPED;
             if (instr->type == I_MIDI) {
               send_midi(instr->note,0,instr->midi_port,instr->midi_channel,127);
             }
           }
-          else if (!r->fired && playhead_samples>=rstart_smp && playhead_samples<rstop_smp) {
+          else if (!(flags&RF_FIRED) && playhead_samples>=rstart_smp && playhead_samples<rstop_smp) {
             if (instr->type == I_SAMPLE) {
               //printf("sample voice fired: %s rstart: %ld\n",instr->path,rstart);
 
@@ -303,7 +1296,7 @@ int jack_process_callback(jack_nframes_t nframes, void *notused)
                 int size = nframes;
                 if (instr->pcm_size<=offset+nframes) {
                   size = instr->pcm_size-offset;
-                  r->fired = true;
+                  flags |= RF_FIRED;
                 }
                 
                 if (audio_out) {
@@ -311,11 +1304,11 @@ int jack_process_callback(jack_nframes_t nframes, void *notused)
                 }
               }
             } else {
-              r->fired = true;
+              flags |= RF_FIRED;
               send_midi(instr->note,1,instr->midi_port,instr->midi_channel,127);
             }
           }
-          else if (!r->fired && playhead_samples<rstart_smp && (playhead_samples+nframes)>rstart_smp) {
+          else if (!(flags&RF_FIRED) && playhead_samples<rstart_smp && (playhead_samples+nframes)>rstart_smp) {
             // playback buffer reaches into beginning of frame
             if (instr->type == I_SAMPLE) {
               long offset = (rstart_smp - playhead_samples);
@@ -325,7 +1318,7 @@ int jack_process_callback(jack_nframes_t nframes, void *notused)
               /*int size = nframes - rstart_smp;
               if (instr->pcm_size<=offset+nframes) {
                 size = instr->pcm_size-offset;
-                r->fired = true;
+                flags |= RF_FIRED;
               }*/
                 
               if (audio_out) {
@@ -337,11 +1330,17 @@ int jack_process_callback(jack_nframes_t nframes, void *notused)
         }
       } // end region loop
 
-      ti++;
+      if (st.lanes_end>st.lanes_begin && default_instr && default_instr->type == I_MIDI) {
+        render_automation(sc, st, default_instr, nframes, bpm_factor);
+      }
     } // end track loop
 
+    flush_automation_queue();
+
     playhead += delta_ns;
     playhead_samples += nframes;
+  } else {
+    publish_playhead(jack_last_frame_time(jack_client), 0);
   }
   
 	return 0;
@@ -400,6 +1399,8 @@ void init_jack() {
   }
 }
 
+void on_peaks_ready(PeakPyramid* p);
+
 static int load_wave_file(Instrument* instr, const char *wavename)
 {
   SNDFILE *infile;
@@ -418,16 +1419,18 @@ static int load_wave_file(Instrument* instr, const char *wavename)
 
   instr->pcm = data;
   instr->pcm_size = sfinfo.frames;
+  instr->peaks = peaks_open(wavename, data, sfinfo.frames, on_peaks_ready);
   
   sf_close(infile);
   printf ("-- load_wave_file: loaded %s %d\n", wavename, instr->pcm_size);
   return 0;
 }
 
-GLV glv_root;
+void on_frame(View* v, GLV& glv);
+
+GLV glv_root(on_frame);
 View* tracks_view;
 View* selection_rect;
-vector<View*> grid_lines;
 View* header_view;
 View* playhead_view;
 View* loop_start_marker;
@@ -439,27 +1442,71 @@ Track* selected_track = NULL;
 Buttons* toolbar;
 NumberDialer* bpm_dialer;
 TextView* title_view;
+UIStatsOverlay* stats_overlay = NULL;
+glv::Window* main_window = NULL;
 
 int win_w;
 int win_h;
 float track_h;
-float scroll_x = 500;
-float zoom_x = 0.5;
+// pixels; kept in double so that positions far into a song stay exact
+double scroll_x = 500;
+double zoom_x = 0.5;
+
+// parts of the arrangement that are out of sync with the model. edits mark
+// what they touched and update_ui() syncs only those parts on the GL thread.
+// region edits don't go through these flags but dirty single lanes, see
+// mark_track_dirty().
+enum ui_dirty_t {
+  UI_TRACKS = 1,   // tracks added/removed, track selection
+  UI_VIEWPORT = 2, // scroll, zoom; lanes apply it as a transform
+  UI_PLAYHEAD = 4,
+  UI_LOOP = 8,
+  UI_LANES = 16,   // bpm; rebuilds every lane
+  UI_ALL = 31
+};
+
+std::atomic<int> ui_dirty(UI_ALL);
+
+void mark_dirty(int parts) {
+  ui_dirty |= parts;
+  if (parts & (UI_TRACKS|UI_LANES)) schedule_stale = true;
+  glv_root.refresh();
+}
+
+void mark_track_dirty(Track* t);
+void mark_region_dirty(RegionRef h);
+void undo_begin(const char* name);
+void undo_end();
+void undo_track_added(Track* t);
+void track_insert(int index, Track* track, Instrument* instr);
+
+// set by the peaks worker threads, on_frame() redoes the waveforms waiting for them
+static std::atomic<bool> peaks_arrived(false);
+
+// called from the peaks worker thread; the GUI thread may be sleeping
+void on_peaks_ready(PeakPyramid* p) {
+  peaks_arrived.store(true, std::memory_order_release);
+  x11_wake();
+}
 
 void zoom_in_x() {
   zoom_x *= 2.0;
+  mark_dirty(UI_VIEWPORT);
 }
 
 void zoom_out_x() {
   zoom_x /= 2.0;
+  mark_dirty(UI_VIEWPORT);
 }
 
 void scroll_left() {
   scroll_x += 1000;
+  mark_dirty(UI_VIEWPORT);
 }
 
 void scroll_right() {
   scroll_x -= 1000;
+  mark_dirty(UI_VIEWPORT);
 }
 
 enum mouse_state_t {
@@ -472,6 +1519,7 @@ enum mouse_state_t {
 mouse_state_t mouse_state = MS_IDLE;
 int mouse_dx = 0;
 int mouse_dy = 0;
+static bool drag_step_open = false;
 long drag_x1 = 0;
 long drag_y1 = 0;
 int old_track_dy = 0;
@@ -479,85 +1527,432 @@ View* hover_track_view = NULL;
 
 void toggle_playback() {
   playback_enabled = 1-playback_enabled;
-  do_playback_cleanup();
-  playback_clean_up = 1;
+  playback_clean_up = 1; // on the RT thread, which owns the playback state
+  mark_dirty(UI_PLAYHEAD);
 }
 
-MPRegion* view_to_region(View* v) {
-  for (Track* t : active_project.tracks) {
-    for (MPRegion* r : t->regions) {
-      if (r->view == v) {
-        return r;
-      }
-    }
+// lane -> track, kept up to date by set_track_view() so that pointer
+// handlers don't scan the track list
+unordered_map<View*, Track*> view_tracks;
+
+void set_track_view(Track* t, View* v) {
+  if (t->view) view_tracks.erase(t->view);
+  t->view = v;
+  if (v) view_tracks[v] = t;
+}
+
+Track* view_to_track(View* v) {
+  // children of a lane such as its label belong to the lane's track
+  for (; v; v = v->parent) {
+    unordered_map<View*, Track*>::iterator it = view_tracks.find(v);
+    if (it != view_tracks.end()) return it->second;
   }
   return NULL;
 }
 
-Track* view_to_track(View* v) {
-  for (Track* t : active_project.tracks) {
-    if (t->view == v) {
-      return t;
+Track* region_to_track(RegionRef h) {
+  int row = region_row(h);
+  if (row<0) return NULL;
+  int t = region_store.track_id[row];
+  return (t>=0 && t<active_project.tracks.size()) ? active_project.tracks[t] : NULL;
+}
+
+// a copy, callers may change the selection while they walk it
+vector<RegionRef> selected_regions() {
+  return region_store.selection;
+}
+
+void deselect_regions() {
+  RegionStore& rs = region_store;
+  for (RegionRef h : rs.selection) {
+    rs.flags[region_row(h)] &= ~RF_SELECTED;
+    mark_region_dirty(h);
+  }
+  rs.selection.clear();
+}
+
+// regions in timeline units: x = inpoint*bpm_factor, 1 unit is one pixel at zoom 1
+static double region_left(uint32_t row) {
+  return region_store.inpoint[row]*240.0/bpm;
+}
+
+static double region_right(uint32_t row) {
+  return region_left(row) + region_store.length[row];
+}
+
+// region geometry in pixels relative to its track lane
+Rect region_rect(uint32_t row) {
+  return Rect(scroll_x + region_left(row)*zoom_x, 0, region_store.length[row]*zoom_x, track_h);
+}
+
+RegionRef region_at(Track* t, float x) {
+  float bpm_factor = 240.0/bpm;
+  double pos = (x-scroll_x)/zoom_x/bpm_factor; // region units
+
+  vector<uint32_t> rows;
+  region_query(t->id, pos, ::floor(pos)+1, 1.0/bpm_factor, rows);
+
+  // last region is drawn on top
+  for (int i=rows.size()-1; i>=0; i--) {
+    Rect rect = region_rect(rows[i]);
+    if (x>=rect.left() && x<rect.right()) return region_ref(rows[i]);
+  }
+  return NO_REGION;
+}
+
+static void add_line(GraphicsData& gd, float x0, float y0, float x1, float y1, const Color& c) {
+  gd.addVertex2(x0,y0, x1,y1);
+  gd.addColor(c,c);
+}
+
+// time signature of the grid. a bar is always 1000 region units and the
+// tempo math assumes 4/4.
+static int beats_per_bar = 4;
+
+// grid lines closer than this are thinned out
+#define GRID_MIN_SPACING 8.0
+
+// beat lines are the same for every lane. they are generated for the
+// visible part of the timeline only, in lane coordinates rather than
+// timeline units so that they stay exact far into long songs, and shared
+// until the viewport, tempo or lane size changes.
+static GraphicsData lane_grid;
+static double lane_grid_scroll = 0;
+static double lane_grid_zoom = 0;
+static float lane_grid_bpm = 0;
+static float lane_grid_w = 0;
+static float lane_grid_h = 0;
+
+static void rebuild_lane_grid(float w, float h) {
+  lane_grid.retain(true);
+  lane_grid.reset();
+
+  double beat_w = 1000.0/beats_per_bar*240.0/bpm*zoom_x; // pixels
+  Color beat_color(0.9,0.9,1,0.08);
+  Color bar_color(0.9,0.9,1,0.12);
+
+  // every beat, then every bar, then every 2nd, 4th, ... bar
+  long step = 1;
+  while (step*beat_w < GRID_MIN_SPACING) {
+    step = (step<beats_per_bar) ? beats_per_bar : step*2;
+  }
+
+  long first = (long)::ceil(-scroll_x/beat_w/step)*step;
+  if (first<0) first = 0;
+  for (long i=first; scroll_x+i*beat_w<=w; i+=step) {
+    float x = scroll_x + i*beat_w;
+    add_line(lane_grid, x, 0, x, h, (i%beats_per_bar>0) ? beat_color : bar_color);
+  }
+
+  lane_grid_scroll = scroll_x;
+  lane_grid_zoom = zoom_x;
+  lane_grid_bpm = bpm;
+  lane_grid_w = w;
+  lane_grid_h = h;
+}
+
+// one view per track. regions and selection borders are not views of
+// their own but quads and lines that the lane batches into a few draws. the geometry is kept in timeline units in vertex buffer objects
+// and placed with a single translate/scale at draw time, so scrolling and
+// zooming don't touch it. it is only rebuilt when the lane is marked dirty
+// or the view moves far from the origin the vertices are relative to, so
+// that the float vertices stay exact near the visible part of long songs.
+// waveforms have one column per pixel and are the exception: they are
+// built for a window around the visible part and redone when the zoom
+// changes or the view scrolls out of that window.
+// when zoomed out far enough that most regions start less than half a pixel
+// after the one before, the lane draws density spans instead: the regions
+// starting in the same pixel column merged into one quad, so there is at
+// most one quad per column of region starts.
+class TrackLane : public View {
+public:
+  TrackLane(Track* t, const Rect& r): View(r), track(t), dirty(true), waves_pending(false), origin(0), wave_zoom(0), wave_x0(0), wave_x1(0), spans_zoom(0), spans_below_zoom(0), use_spans(false) {
+    fills.retain(true);
+    borders.retain(true);
+    waves.retain(true);
+    spans.retain(true);
+  }
+
+  virtual void onDraw(GLV& g);
+
+  Track* track;
+  bool dirty;
+  bool waves_pending; // the waveforms lack samples whose peaks were not ready
+
+  // rebuilds the waveforms when the lane is drawn next
+  void redo_waves() { wave_zoom = 0; }
+
+private:
+  GraphicsData fills;
+  GraphicsData borders;
+  GraphicsData waves;
+  GraphicsData spans;
+
+  // timeline position of vertex x 0
+  double origin;
+
+  // zoom and timeline range the waveforms were built for
+  double wave_zoom;
+  double wave_x0;
+  double wave_x1;
+
+  // zoom the spans were merged for, and the zoom below which they are used
+  double spans_zoom;
+  double spans_below_zoom;
+  bool use_spans;
+  
+  void rebuild();
+  void rebuild_waves(double x0, double x1);
+  void rebuild_spans();
+  void add_quad(GraphicsData& gd, float l, float t, float r, float b, const Color& c);
+  void add_waveform(GraphicsData& gd, Instrument* instr, double l, double r, double x0, double x1);
+};
+
+void TrackLane::add_quad(GraphicsData& gd, float l, float t, float r, float b, const Color& c) {
+  unsigned i = gd.vertices2().size();
+  gd.addVertex2(l,t, r,t, r,b, l,b);
+  gd.addColor(c,c,c,c);
+  gd.addIndex(i,i+1,i+2);
+  gd.addIndex(i,i+2,i+3);
+}
+
+// one column per pixel from the peak level matching the zoom, so the cost
+// doesn't depend on the sample length. columns are aligned to whole pixels
+// of the timeline at the current zoom and stored in timeline units.
+void TrackLane::add_waveform(GraphicsData& gd, Instrument* instr, double l, double r, double x0, double x1) {
+  double samples_per_px = 48.0/zoom_x;
+  const PeakLevel* level = peaks_level_for(instr->peaks, samples_per_px);
+  if (!level) {
+    waves_pending = true;
+    return;
+  }
+
+  float mid = h/2;
+  float amp = h/2 - 1;
+  double px_l = l*zoom_x;
+  long c0 = (long)::floor((l>x0 ? l : x0)*zoom_x);
+  long c1 = (long)::ceil((r<x1 ? r : x1)*zoom_x);
+
+  Color peak_color(1,1,1,0.25);
+  Color rms_color(1,1,1,0.45);
+  
+  for (long c=c0; c<c1; c++) {
+    double s0 = (c - px_l)*samples_per_px;
+    if (s0<0) s0 = 0;
+    if (s0>=instr->pcm_size) break;
+
+    float mn, mx, rms;
+    if (!peaks_range(level, s0, s0+samples_per_px, &mn, &mx, &rms)) continue;
+    if (mx>1) mx = 1;
+    if (mn<-1) mn = -1;
+    if (rms>1) rms = 1;
+
+    float xl = c/zoom_x - origin, xr = (c+1)/zoom_x - origin;
+    add_quad(gd, xl, mid-mx*amp, xr, mid-mn*amp, peak_color);
+    add_quad(gd, xl, mid-rms*amp, xr, mid+rms*amp, rms_color);
+  }
+}
+
+void TrackLane::rebuild() {
+  fills.reset();
+  borders.reset();
+
+  StyleColor normal, selected;
+  normal.set(Color((float)track->r/10.0,(float)track->g/10.0,(float)track->b/10.0, 0.7));
+  selected.set(Color((float)track->r/10.0,(float)track->g/10.0,(float)track->b/10.0, 0.9));
+
+  // gaps between region starts, for the zoom at which spans pay off
+  static vector<double> gaps;
+  gaps.clear();
+
+  float t = 0, b = h;
+  uint32_t first = track_rows_begin(track->id);
+  for (uint32_t r=first; r<track_rows_end(track->id); r++) {
+    if (r>first && region_store.inpoint[r]>region_store.inpoint[r-1]) {
+      gaps.push_back(region_left(r)-region_left(r-1));
+    }
+    float l = region_left(r)-origin, rr = region_right(r)-origin;
+    if (region_store.flags[r]&RF_SELECTED) {
+      add_quad(fills, l, t, rr, b, selected.back);
+      // lines keep their 1px width when the lane is scaled
+      add_line(borders, l, t, rr, t, selected.border);
+      add_line(borders, l, b-1, rr, b-1, selected.border);
+      add_line(borders, l, t, l, b, selected.border);
+      add_line(borders, rr, t, rr, b, selected.border);
+    } else {
+      add_quad(fills, l, t, rr, b, normal.back);
     }
   }
-  return NULL;
+
+  // spans once the median gap is below half a pixel. regions that start
+  // together don't count, they never merge into fewer columns.
+  spans_below_zoom = 0;
+  if (gaps.size()) {
+    nth_element(gaps.begin(), gaps.begin()+gaps.size()/2, gaps.end());
+    spans_below_zoom = 0.5/gaps[gaps.size()/2];
+  }
+
+  wave_zoom = 0; // regions may have moved
+  spans_zoom = 0;
+  dirty = false;
 }
 
-Track* region_to_track(MPRegion* r_needle) {
-  for (Track* t : active_project.tracks) {
-    for (MPRegion* r : t->regions) {
-      if (r == r_needle) {
-        return t;
-      }
+// merges the regions that start within a pixel of a span's start. a span's
+// opacity shows how much of it is covered by regions, it is highlighted if
+// any of them is selected.
+void TrackLane::rebuild_spans() {
+  spans.reset();
+  use_spans = false;
+  spans_zoom = zoom_x;
+
+  double px = 1.0/zoom_x;
+  Color normal((float)track->r/10.0,(float)track->g/10.0,(float)track->b/10.0, 0.7);
+  Color selected((float)track->r/10.0,(float)track->g/10.0,(float)track->b/10.0, 0.9);
+
+  // rows are sorted by inpoint
+  uint32_t first = track_rows_begin(track->id);
+  uint32_t end = track_rows_end(track->id);
+  unsigned count = 0;
+  for (uint32_t i=first; i<end;) {
+    double l = region_left(i);
+    double r = region_right(i);
+    double covered = r-l;
+    bool sel = region_store.flags[i]&RF_SELECTED;
+
+    for (i++; i<end; i++) {
+      double nl = region_left(i);
+      if (nl-l>=px) break;
+      double nr = region_right(i);
+      double from = nl>r ? nl : r; // don't count overlaps twice
+      if (nr>from) covered += nr-from;
+      if (nr>r) r = nr;
+      sel |= region_store.flags[i]&RF_SELECTED;
     }
+    if (r-l<px) r = l+px;
+
+    float density = covered/(r-l);
+    if (density>1) density = 1;
+    Color c = sel ? selected : normal;
+    c.a *= 0.4+0.6*density;
+    add_quad(spans, l-origin, 0, r-origin, h, c);
+    count++;
   }
-  return NULL;
+
+  // only worth it if it at least halves the quads
+  use_spans = 2*count<=end-first;
 }
 
-vector<MPRegion*> selected_regions() {
-  vector<MPRegion*> res;
-  for (Track* t : active_project.tracks) {
-    for (MPRegion* r : t->regions) {
-      if (r->selected) {
-        res.push_back(r);
+void TrackLane::rebuild_waves(double x0, double x1) {
+  waves.reset();
+  waves_pending = false;
+
+  // one screen of margin on both sides
+  double margin = x1-x0;
+  x0 -= margin;
+  x1 += margin;
+
+  float bpm_factor = 240.0/bpm;
+  vector<uint32_t> rows;
+  region_query(track->id, x0/bpm_factor, x1/bpm_factor, 1.0/bpm_factor, rows);
+
+  for (uint32_t r : rows) {
+    double l = region_left(r), rr = region_right(r);
+
+    int iid = region_store.instrument_id[r];
+    if (iid>=0 && iid<active_project.instruments.size()) {
+      Instrument* instr = active_project.instruments[iid];
+      if (instr->type == I_SAMPLE && instr->peaks) {
+        add_waveform(waves, instr, l, rr, x0, x1);
       }
     }
   }
-  return res;
+
+  wave_zoom = zoom_x;
+  wave_x0 = x0;
+  wave_x1 = x1;
 }
 
-void deselect_regions() {
-  vector<MPRegion*> regions = selected_regions();
+void TrackLane::onDraw(GLV& g) {
+  // visible part of the timeline
+  float lane_w = tracks_view ? tracks_view->width() : w;
+  double x0 = -scroll_x/zoom_x;
+  double x1 = (lane_w-scroll_x)/zoom_x;
+
+  // a few screens away from the origin the vertices get coarse
+  if (::fabs(x0-origin)>4*(x1-x0)) {
+    origin = x0;
+    dirty = true;
+  }
+  if (dirty) rebuild();
+
+  if (selected_track == track) {
+    draw::color(colors().back);
+    draw::rectangle(0, 0, w, h);
+  }
+
+  if (zoom_x!=wave_zoom || x0<wave_x0 || x1>wave_x1) rebuild_waves(x0, x1);
+
+  if (lane_grid_scroll!=scroll_x || lane_grid_zoom!=zoom_x || lane_grid_bpm!=bpm
+      || lane_grid_w!=lane_w || lane_grid_h!=h) rebuild_lane_grid(lane_w, h);
+  if (lane_grid.vertices2().size()) draw::paint(draw::Lines, lane_grid);
 
-  for (MPRegion* r : regions) {
-    r->selected = false;
+  draw::push();
+  draw::translate(scroll_x + origin*zoom_x, 0);
+  draw::scale(zoom_x, 1);
+  if (zoom_x>=spans_below_zoom) {
+    use_spans = false;
+  } else if (spans_zoom!=zoom_x) {
+    rebuild_spans();
   }
+  if (use_spans) {
+    draw::paint(draw::Triangles, spans);
+  } else if (fills.indices().size()) {
+    draw::paint(draw::Triangles, fills);
+  }
+  if (waves.indices().size()) draw::paint(draw::Triangles, waves);
+  if (!use_spans && borders.vertices2().size()) draw::paint(draw::Lines, borders);
+  draw::pop();
+}
+
+void mark_track_dirty(Track* t) {
+  if (!t) return;
+  schedule_stale = true;
+  if (t->view) ((TrackLane*)t->view)->dirty = true;
+  glv_root.refresh();
+}
+
+void mark_region_dirty(RegionRef h) {
+  mark_track_dirty(region_to_track(h));
 }
 
 void delete_selected_regions() {
-  vector<MPRegion*> regions = selected_regions();
-
-  for (MPRegion* r : regions) {
-    Track* t = region_to_track(r);
-    if (t) {
-      vector<MPRegion*>& v = t->regions;
-      r->view->remove();
-      v.erase(remove(begin(v), end(v), r), end(v));
-    }
-  }
+  vector<RegionRef> regions = selected_regions();
+  deselect_regions();
+  vector<RegionRow> none;
+  region_store_apply(regions, none);
 }
 
 void select_regions_in_rect(Rect& rect) {
+  float bpm_factor = 240.0/bpm;
+  vector<uint32_t> rows;
+
   for (Track* t : active_project.tracks) {
-    for (MPRegion* r : t->regions) {
-      if (r->view) {
-        Rect shifted = Rect(*(r->view));
-        shifted.posAdd(t->view->left(), t->view->top());
+    if (!t->view) continue;
+    if (t->view->bottom()<rect.top() || t->view->top()>rect.bottom()) continue;
+
+    // horizontal extent of the rubber band in region units
+    float x0 = rect.left()-t->view->left();
+    float x1 = rect.right()-t->view->left();
+    rows.clear();
+    region_query(t->id, (x0-scroll_x)/zoom_x/bpm_factor-1, (x1-scroll_x)/zoom_x/bpm_factor+1, 1.0/bpm_factor, rows);
+
+    for (uint32_t r : rows) {
+      Rect shifted = region_rect(r);
+      shifted.posAdd(t->view->left(), t->view->top());
       
-        if (shifted.intersects(rect)) {
-          //printf("intersects: %f %f %f %f\n",r->view->left(),r->view->top(),r->view->width(),r->view->height());
-          r->selected = true;
-        }
+      if (shifted.intersects(rect)) {
+        region_select(region_ref(r));
+        mark_track_dirty(t);
       }
     }
   }
@@ -575,6 +1970,10 @@ bool on_root_mouseup(View * v, GLV& glv) {
     select_regions_in_rect(*selection_rect);
     selection_rect->disable(Visible);
   }
+  if (drag_step_open) {
+    drag_step_open = false;
+    undo_end();
+  }
   mouse_state = MS_IDLE;
 
   return false;
@@ -587,35 +1986,39 @@ bool on_root_mousedown(View * v, GLV& glv) {
   return false;
 }
 
-bool on_region_mousedown(View * v, GLV& glv) {
+bool on_region_mousedown(RegionRef h, GLV& glv) {
+  RegionStore& rs = region_store;
 
   mouse_state = MS_MOVING;
   
-  MPRegion* r = view_to_region(v);
-  printf("on_region_mousedown: %x\n",r);
-  if (r) {
-    vector<MPRegion*> regions = selected_regions();
+  int row = region_row(h);
+  if (row>=0) {
+    // moves and clones until the mouse is released are one step
+    if (!drag_step_open) {
+      drag_step_open = true;
+      undo_begin("drag regions");
+    }
+
+    vector<RegionRef> regions = selected_regions();
     
     if (!glv.keyboard().shift() && !glv.keyboard().ctrl() && regions.size()<2) {
-      for (MPRegion* r : regions) {
-        r->selected = false;
+      for (RegionRef sh : regions) {
+        region_deselect(sh);
+        mark_region_dirty(sh);
       }
     }
 
-    r->selected = true;
+    region_select(h);
+    mark_region_dirty(h);
       
     if (glv.keyboard().ctrl()) {
       // clone region
-      for (MPRegion* sr : regions) {
-        Track* t = region_to_track(sr);
-        if (t) {
-          MPRegion* dup = new MPRegion;
-          memcpy(dup, sr, sizeof(MPRegion));
-          dup->view = NULL;
-          dup->selected = true;
-          t->regions.push_back(dup);
-          sr->selected = false;
-        }
+      for (RegionRef sh : regions) {
+        int r = region_row(sh);
+        RegionRef dup = region_add(rs.track_id[r], rs.inpoint[r], rs.length[r], rs.instrument_id[r], 0);
+        region_select(dup);
+        region_deselect(sh);
+        mark_region_dirty(dup);
       }
     }
     
@@ -626,13 +2029,24 @@ bool on_region_mousedown(View * v, GLV& glv) {
     drag_x1 = glv.mouse().x();
     drag_y1 = glv.mouse().y();
 
-    for (MPRegion* sr : selected_regions()) {
-      sr->_prev_inpoint = sr->inpoint; // save state when we started dragging
+    for (RegionRef sh : rs.selection) {
+      int r = region_row(sh);
+      rs.drag_inpoint[r] = rs.inpoint[r]; // save state when we started dragging
     }
   }
   return false;
 }
 
+bool on_lane_mousedown(View * v, GLV& glv) {
+  TrackLane* lane = (TrackLane*)v;
+  float x = glv.mouse().x() - tracks_view->left() - lane->left();
+
+  RegionRef h = region_at(lane->track, x);
+  if (region_row(h)<0) return true; // empty space, handled by on_track_mousedown
+  
+  return on_region_mousedown(h, glv);
+}
+
 long snap_time(long p) {
   long snap = 1000/8;
   long thresh = 20;
@@ -642,8 +2056,8 @@ long snap_time(long p) {
 
   //printf("p: %ld p1: %ld\n",p,p1);
 
-  if (abs(p-p1) < thresh) return p1;
-  if (abs(p-p2) < thresh) return p2;
+  if (labs(p-p1) < thresh) return p1;
+  if (labs(p-p2) < thresh) return p2;
   
   return p;
 }
@@ -661,7 +2075,8 @@ bool on_loop_start_drag(View* v, GLV& glv) {
   Mouse m = glv.mouse();
   mouse_dx += m.dx();
   
-  loop_start_point = snap_time(drag_x1 + (mouse_dx/zoom_x/bpm_factor));
+  loop_start_point = snap_time(drag_x1 + lround(mouse_dx/zoom_x/bpm_factor));
+  mark_dirty(UI_LOOP);
   return false;
 }
 
@@ -678,7 +2093,8 @@ bool on_loop_end_drag(View* v, GLV& glv) {
   Mouse m = glv.mouse();
   mouse_dx += m.dx();
 
-  loop_end_point = snap_time(drag_x1 + (mouse_dx/zoom_x/bpm_factor));
+  loop_end_point = snap_time(drag_x1 + lround(mouse_dx/zoom_x/bpm_factor));
+  mark_dirty(UI_LOOP);
   return false;
 }
 
@@ -696,43 +2112,29 @@ bool on_root_mousemove(View* v, GLV& glv) {
   if (mouse_state == MS_MOVING) {
     int track_ddy = track_dy-old_track_dy;
       
-    vector<MPRegion*> regions = selected_regions();
-    for (MPRegion* r : regions) {
-      r->inpoint = snap_time(r->_prev_inpoint + mouse_dx/zoom_x/bpm_factor);
+    RegionStore& rs = region_store;
+    vector<RegionRef> regions = selected_regions();
+    for (RegionRef h : regions) {
+      region_set_inpoint(h, snap_time(rs.drag_inpoint[region_row(h)] + lround(mouse_dx/zoom_x/bpm_factor)));
+      mark_region_dirty(h);
 
       // allow cross-track moving only inside bounds
-      if ((r->track_id+track_ddy)<0 || (r->track_id+track_ddy)>active_project.tracks.size()-1) {
+      int track_id = rs.track_id[region_row(h)];
+      if ((track_id+track_ddy)<0 || (track_id+track_ddy)>active_project.tracks.size()-1) {
         track_ddy = 0;
       }
     }
 
     if (track_ddy!=0) {
-      printf("move across tracks %d\n",track_ddy);
-      vector<MPRegion*> regions = selected_regions();
-      
-      for (MPRegion* r : regions) {
-        Track* t = region_to_track(r);
-        
-        vector<MPRegion*>& v = t->regions;
-        v.erase(remove(begin(v), end(v), r), end(v));
-
+      for (RegionRef h : regions) {
+        Track* t = region_to_track(h);
         int new_id = t->id + track_ddy;
-        
         Track* new_track = active_project.tracks[new_id];
-        /*MPRegion* new_r = new MPRegion {r->id,
-                                new_id,
-                                r->inpoint,
-                                r->length,
-                                new_id};*/
-        //new_r->_prev_inpoint = r->_prev_inpoint;
-        //new_r->selected = true;
-        // recycle the view
-        //new_r->view = r->view;
-        //r->view = NULL;
-        r->track_id = new_id;
-        r->instrument_id = new_id;
-        *new_track->view << *r->view;
-        new_track->regions.push_back(r);
+
+        region_set_track(h, new_id);
+        rs.instrument_id[region_row(h)] = new_id;
+        mark_track_dirty(t);
+        mark_track_dirty(new_track);
       }
       
       old_track_dy = track_dy;
@@ -742,7 +2144,10 @@ bool on_root_mousemove(View* v, GLV& glv) {
 }
 
 bool on_bpm_keyup(View * v, GLV& glv) {
+  undo_begin("bpm");
   bpm = bpm_dialer->getValue();
+  undo_end();
+  mark_dirty(UI_VIEWPORT|UI_LOOP|UI_PLAYHEAD|UI_LANES);
 }
 
 bool on_selection_rect_drag(View* v, GLV& glv) {
@@ -784,7 +2189,7 @@ bool on_selection_rect_drag(View* v, GLV& glv) {
 
 Cell* lisp_add_region_at_mouse(Cell* args, Cell* env) {
   float bpm_factor = 240.0/bpm;
-  space_t x = glv_root.mouse().x() - scroll_x;
+  space_t x = glv_root.mouse().x();
   space_t y = glv_root.mouse().y();
   
   hover_track_view = glv_root.findTarget(x, y);
@@ -794,14 +2199,11 @@ Cell* lisp_add_region_at_mouse(Cell* args, Cell* env) {
   // create note
   Track* t = view_to_track(hover_track_view);
   if (t) {
-    int inpoint = snap_time(x/zoom_x/bpm_factor);
+    // x is relative to the lane now
+    long inpoint = snap_time((x-scroll_x)/zoom_x/bpm_factor);
     int duration = 50;
-    MPRegion* r = new MPRegion {1,
-                                t->id,
-                                inpoint,
-                                duration,
-                                t->id};
-    t->regions.push_back(r);
+    region_add(t->id, inpoint, duration, t->id, 0);
+    mark_track_dirty(t);
   }
 
   return alloc_nil();
@@ -824,6 +2226,7 @@ bool on_track_mousedown(View* v, GLV& glv) {
 
   hover_track_view = glv_root.findTarget(x, y);
   selected_track = view_to_track(hover_track_view);
+  mark_dirty(UI_TRACKS);
   if (selected_track) {
     //printf("selected_track: %p (id: %d)\n",selected_track,selected_track->id);
   }
@@ -836,9 +2239,9 @@ bool on_track_mousedown(View* v, GLV& glv) {
 }
 
 Cell* external_edit_selected_region(Cell* args, Cell* env) {
-  vector<MPRegion*> rs = selected_regions();
-  MPRegion* r = rs[0];
-  Instrument* instr = active_project.instruments[r->instrument_id];
+  vector<RegionRef> rs = selected_regions();
+  if (!rs.size()) return alloc_nil();
+  Instrument* instr = active_project.instruments[region_store.instrument_id[region_row(rs[0])]];
   string cmd = "mhwaveedit --driver jack \""+string(instr->path)+"\"";
   system(cmd.c_str());
 
@@ -865,9 +2268,11 @@ bool on_root_keydown(View * v, GLV& glv) {
     break;
   case ',':
     set_playhead(playhead - 250*TMUL);
+    mark_dirty(UI_PLAYHEAD);
     break;
   case '.':
     set_playhead(playhead + 250*TMUL);
+    mark_dirty(UI_PLAYHEAD);
     break;
   case 13:
     // cursor left
@@ -877,18 +2282,22 @@ bool on_root_keydown(View * v, GLV& glv) {
     scroll_right();
     break;
   case 8: // backspace
+    undo_begin("delete regions");
     delete_selected_regions();
+    undo_end();
     break;
   default: {
     char buf[1024];
     sprintf(buf,"(handle-key \"%c\")",k);
+    double t = uistats_now_ms();
+    undo_begin(buf); // whatever the binding edits is one step
     eval(read_string(buf), get_globals());
+    undo_end();
+    uistats_eval(uistats_now_ms()-t);
   }
   }
 }
 
-static int song_bars = 4*100;
-
 char* note_to_label(Instrument* i) {
   char buf[64];
   int octave = i->note/12;
@@ -938,6 +2347,10 @@ void update_ui() {
   Project& p = active_project;
   float bpm_factor = 240.0/bpm;
 
+  int dirty = ui_dirty.exchange(0);
+  if (playback_enabled) dirty |= UI_PLAYHEAD;
+  if (!dirty) return;
+
   win_w = 2560;
   win_h = 1600;
 
@@ -948,21 +2361,7 @@ void update_ui() {
     tracks_view->colors().set(Color(0.2,0.4,1,0.8), 1.0);
     tracks_view->disable(DrawBack);
     tracks_view->disable(DrawBorder);
-
-    for (int i=0; i<song_bars; i++) {
-      // 1000px = 1  bar
-      // 250px = 1/4 bar (beat)
-      int x = (int)(250.0*zoom_x*bpm_factor*i);
-      View* l = new View(Rect(x,0,1,win_h));
-      if (i%4>0) {
-        l->cloneStyle().colors().set(Color(0.9,0.9,1,0.08), 1.0);
-      } else {
-        l->cloneStyle().colors().set(Color(0.9,0.9,1,0.12), 1.0);
-      }
-      l->disable(DrawBack);
-      grid_lines.push_back(l);
-      *tracks_view << l;
-    }
+    tracks_view->indexChildren(win_w, track_h); // one row of cells per track for hover hit tests
 
     selection_rect = new View(Rect(0,0,0,0));
     selection_rect->cloneStyle().colors().set(Color(1,1,1,0.3), 0.3);
@@ -974,13 +2373,7 @@ void update_ui() {
     
     glv_root << tracks_view;
   } else {
-    int i = 0;
     tracks_view->height(win_h);
-    for (View* l : grid_lines) {
-      int x = (int)(scroll_x + 250.0*zoom_x*bpm_factor*(i++));
-      l->left(x);
-      l->height(win_h);
-    }
   }
 
   if (!header_view) {
@@ -1022,9 +2415,11 @@ void update_ui() {
     loop_start_marker->on(Event::MouseDrag, on_loop_start_drag);
     loop_end_marker->on(Event::MouseDown, on_loop_end_init_drag);
     loop_end_marker->on(Event::MouseDrag, on_loop_end_drag);
-  } else {
-    loop_start_marker->left(scroll_x + loop_start_point*zoom_x*bpm_factor);
-    loop_end_marker->left(scroll_x + loop_end_point*zoom_x*bpm_factor);
+  }
+  
+  if (dirty & (UI_VIEWPORT|UI_LOOP)) {
+    loop_start_marker->left(scroll_x + loop_start_point*bpm_factor*zoom_x);
+    loop_end_marker->left(scroll_x + loop_end_point*bpm_factor*zoom_x);
   }
 
   if (!playhead_view) {
@@ -1032,21 +2427,32 @@ void update_ui() {
     playhead_view->cloneStyle().colors().set(Color(1.0,1.0,1.0,0.6), 0.9);
 
     glv_root << playhead_view;
-  } else {
-    float bpm_factor = 240.0/bpm;
-    playhead_view->left(scroll_x + (float)(playhead/TMUL)*zoom_x);
+  }
+  
+  if (dirty & (UI_VIEWPORT|UI_PLAYHEAD)) {
+    playhead_view->left(scroll_x + playhead_now()/TMUL*zoom_x);
     playhead_view->height(win_h);
   }
+
+  if (dirty & UI_LANES) {
+    for (Track* t : p.tracks) {
+      mark_track_dirty(t);
+    }
+  }
+
+  if (!(dirty & UI_TRACKS)) return;
   
   int i=0;
   for (Track* t : p.tracks) {
     if (!t->view) {
-      t->view = new View(Rect(0,track_h*i,win_w*2,track_h));
+      set_track_view(t, new TrackLane(t, Rect(0,track_h*i,win_w*2,track_h)));
+      t->view->on(Event::MouseDown, on_lane_mousedown);
 
       // 0.2,0.4,1
       
       t->view->cloneStyle().colors().set(Color((float)t->r/10.0,(float)t->g/10.0,(float)t->b/10.0,0.1), 0.1);
       t->view->disable(DrawBack);
+      t->view->enable(CropChildren); // lets GLV skip off-screen lanes with their labels
 
       *tracks_view << *t->view;
 
@@ -1057,30 +2463,8 @@ void update_ui() {
       
       //printf("track view added: %x\n",t->view);
     } else {
-      if (selected_track == t) {
-        t->view->enable(DrawBack);
-      } else {
-        t->view->disable(DrawBack);
-      }
-    }
-    
-    for (MPRegion* r : t->regions) {
-      Rect rect = Rect(scroll_x + r->inpoint*zoom_x*bpm_factor,0,r->length*zoom_x,track_h);
-      if (!r->view) {
-        r->view = new View(rect);
-        r->view->cloneStyle();
-        *t->view << *r->view;
-        r->view->on(Event::MouseDown, on_region_mousedown);
-      }
-      
-      r->view->set(rect);
-      if (r->selected) {
-        r->view->colors().set(Color((float)t->r/10.0,(float)t->g/10.0,(float)t->b/10.0, 0.9));
-        r->view->enable(DrawBorder);
-      } else {
-        r->view->colors().set(Color((float)t->r/10.0,(float)t->g/10.0,(float)t->b/10.0, 0.7));
-        r->view->disable(DrawBorder);
-      }
+      t->view->top(track_h*i);
+      mark_track_dirty(t); // selection highlight
     }
     
     i++;
@@ -1128,57 +2512,28 @@ Cell* add_instrument(Cell* args, Cell* env) {
 Cell* set_regions_length(Cell* args, Cell* env) {
   int d = car(args)->value;
 
-  vector<MPRegion*> rs = selected_regions();
-
-  for (MPRegion* r : rs) {
-    r->length = d;
+  for (RegionRef h : selected_regions()) {
+    region_set_length(h, d);
+    mark_region_dirty(h);
   }
   return car(args);
 }
 
-Cell* add_track(Cell* args, Cell* env) {
-  //int id = car(args)->value;
+// creates a track and its instrument at index, or at the end if index is not
+// the index of an existing track. path "midi" makes a MIDI track, anything
+// else names a sample file.
+Track* track_add(int index, char* path, int note, int port, int channel, int r, int g, int b) {
   int id = active_project.tracks.size();
-
-  args = cdr(args);
-  char* path = (char*)(car(args)->addr);
   Instrument* i;
 
-  printf("path: %p %s\n",path,path);
-
   if (!strcmp(path,"midi")) {
-    int note = 48+id;
-    int port = 0;
-    int channel = 0;
-
-    args = cdr(args);
-    note = car(args)->value;
-    args = cdr(args);
-    port = car(args)->value;
-    args = cdr(args);
-    channel = car(args)->value;
-
     path = "MIDI";
 
     i = new Instrument {id, I_MIDI, path, path, note, port, channel};
-    active_project.instruments.push_back(i);
   } else {
     i = new Instrument {id, I_SAMPLE, path, path};
     load_wave_file(i, i->path);
-    
-    active_project.instruments.push_back(i);
   }
-  
-  int r = 4+((4+id)%6);
-  int g = 2;
-  int b = 10;
-
-  args = cdr(args);
-  r = car(args)->value;
-  args = cdr(args);
-  g = car(args)->value;
-  args = cdr(args);
-  b = car(args)->value;
 
   Track* t;
   if (i->type == I_MIDI) {
@@ -1186,134 +2541,468 @@ Cell* add_track(Cell* args, Cell* env) {
   } else {
     t = new Track {id, TRACK_AUDIO, path, r, g, b};
   }
-  active_project.tracks.push_back(t);
-    
-  //printf("add_audio_track: %d %s\n",id,name);
-  
-  return alloc_nil();
+  if (index>=0 && index<id) {
+    track_insert(index, t, i);
+  } else {
+    active_project.tracks.push_back(t);
+    active_project.instruments.push_back(i);
+  }
+  undo_track_added(t);
+  mark_dirty(UI_TRACKS);
+  return t;
 }
 
-Cell* delete_selected_tracks(Cell* args, Cell* env) {
+// creates a track from the arguments (path [note port channel] r g b) of
+// (track) and (track-insert)
+static Track* track_add_args(int index, Cell* args) {
+  char* path = (char*)(car(args)->addr);
+  int note = 0;
+  int port = 0;
+  int channel = 0;
 
-  deselect_regions();
-  if (selected_track) {
-    for (MPRegion* r : selected_track->regions) {
-      r->selected = true;
-    }
-    delete_selected_regions();
+  if (!strcmp(path,"midi")) {
+    args = cdr(args);
+    note = car(args)->value;
+    args = cdr(args);
+    port = car(args)->value;
+    args = cdr(args);
+    channel = car(args)->value;
+  }
 
-    vector<Track*>& v = active_project.tracks;
+  args = cdr(args);
+  int r = car(args)->value;
+  args = cdr(args);
+  int g = car(args)->value;
+  args = cdr(args);
+  int b = car(args)->value;
 
-    printf("size before remove: %d\n",active_project.tracks.size());
-    
-    v.erase(remove(begin(v), end(v), selected_track), end(v));
-    selected_track->view->remove();
+  return track_add(index, path, note, port, channel, r, g, b);
+}
 
-    // remove track instrument
-    vector<Instrument*>& iv = active_project.instruments;
-    Instrument* selected_instr = iv[selected_track->id];
-    iv.erase(remove(begin(iv), end(iv), selected_instr), end(iv));
-    
-    printf("size after remove: %d\n",active_project.tracks.size());
+// (track id path ...) appends a track; id is ignored
+Cell* add_track(Cell* args, Cell* env) {
+  track_add_args(-1, cdr(args));
+  return alloc_nil();
+}
 
-    // move all subsequent tracks up (delete their views) and decrement their ids
+Cell* lisp_err(char* msg);
 
-    printf("deleted track id: %d\n",selected_track->id);
+// (track-insert index path ...) puts a track back at index, which the journal
+// uses to replay undone track deletions
+Cell* lisp_track_insert(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_INT) return lisp_err("(track-insert) invalid param #0 (index)");
+  track_add_args(car(args)->value, cdr(args));
+  return alloc_nil();
+}
 
-    for (int i=selected_track->id; i<active_project.tracks.size(); i++) {
-      Track* t = active_project.tracks[i];
-      printf("%d moving up track %p (id: %d)\n",i,t,t->id);
-      t->id--;
+// removes the track at index together with its regions and instrument.
+// later tracks move up; update_ui() rebuilds their lanes.
+void track_remove(int index) {
+  vector<Track*>& v = active_project.tracks;
+  vector<Instrument*>& iv = active_project.instruments;
+  Track* track = v[index];
 
-      for (MPRegion* r : t->regions) {
-        r->track_id--;
-        r->instrument_id--;
-        r->view->remove();
-        r->view = NULL;
-      }
-      t->view->remove(); // FIXME: dealloc view
-      t->view = NULL;
+  region_store_remove_track(index);
+  v.erase(v.begin()+index);
+  if (track->view) track->view->remove();
+  set_track_view(track, NULL);
+
+  // remove track instrument
+  if (index<iv.size()) iv.erase(iv.begin()+index);
+
+  // move all subsequent tracks up (delete their views) and decrement their ids
+  for (int i=index; i<v.size(); i++) {
+    Track* t = v[i];
+    t->id--;
+
+    for (uint32_t r=track_rows_begin(t->id); r<track_rows_end(t->id); r++) {
+      region_store.instrument_id[r]--;
     }
+    if (t->view) t->view->remove(); // FIXME: dealloc view
+    set_track_view(t, NULL);
   }
 
-  selected_track = NULL;
+  if (selected_track == track) selected_track = NULL;
+  mark_dirty(UI_TRACKS);
 }
 
-Cell* add_midi_octave(Cell* args, Cell* env) {
-  int octave = 3;
-  int port = 0;
-  int channel = 1;
+// inverse of track_remove(), without the regions
+void track_insert(int index, Track* track, Instrument* instr) {
+  vector<Track*>& v = active_project.tracks;
+  vector<Instrument*>& iv = active_project.instruments;
 
-  if (car(args) && car(args)->tag == TAG_INT) {
-    octave = car(args)->value;
+  region_store_insert_track(index);
+  v.insert(v.begin()+index, track);
+  if (instr) iv.insert(iv.begin()+(index<iv.size() ? index : iv.size()), instr);
+  track->id = index;
 
-    args = cdr(args);
-    if (car(args) && car(args)->tag == TAG_INT) {
-      port = car(args)->value;
+  for (int i=index+1; i<v.size(); i++) {
+    Track* t = v[i];
+    t->id++;
+
+    for (uint32_t r=track_rows_begin(t->id); r<track_rows_end(t->id); r++) {
+      region_store.instrument_id[r]++;
     }
+    if (t->view) t->view->remove();
+    set_track_view(t, NULL);
   }
-  
-  int note = octave*12;
-  
-  for (int i=0; i<12; i++) {
-    int r = 0;
-    int g = 7;
-    int b = (2+2*port)%10;
-    
-    char name[64];
-    sprintf(name,"M%d N%d",channel,note);
-    
-    int id = active_project.tracks.size();
-    
-    Track* t = new Track {id, TRACK_MIDI, name, r, g, b};  
-    active_project.tracks.push_back(t);
+  mark_dirty(UI_TRACKS);
+}
 
-    // make instrument
+static size_t journal_compact_bytes = 4*1024*1024; // (journal-compact bytes)
 
-    Instrument* instr = new Instrument {id, I_MIDI, name, "", note, port, channel};
-    active_project.instruments.push_back(instr);
-    
-    note++;
+static vector<UndoStep*> undo_steps;
+static vector<UndoStep*> redo_steps;
+static int undo_depth = 0;
+static size_t undo_bytes = 0;              // both stacks
+static size_t undo_budget = 16*1024*1024;  // (undo-budget bytes)
+
+static size_t undo_step_bytes(UndoStep* st) {
+  return sizeof(UndoStep) + st->regions.capacity()*sizeof(RegionDelta) + st->tracks.capacity()*sizeof(TrackDelta);
+}
+
+static void undo_free_steps(vector<UndoStep*>& steps) {
+  for (UndoStep* st : steps) {
+    undo_bytes -= undo_step_bytes(st);
+    delete st;
   }
-  return alloc_nil();
+  steps.clear();
 }
 
-Cell* bounce_loop(Cell* args, Cell* env) {
-  float bpm_factor = 240.0/bpm;
-    
-  playback_enabled = 0;
-  playback_clean_up = 1;
-  
-  char buf[1024];
-  // 2 seconds padding
-  int seconds = 2+((loop_end_point-loop_start_point)/250)/bpm*60;
-  
-  sprintf(buf,"jack_capture -z 2 -d %d &", seconds);
-  printf("bouncing using: %s\n",buf);
+// steps nest; the outermost one collects everything
+void undo_begin(const char* name) {
+  if (undo_depth++) return;
 
-  system(buf);
+  undo_current = new UndoStep;
+  snprintf(undo_current->name, sizeof(undo_current->name), "%s", name);
+  undo_current->bpm_before = bpm;
+  undo_discard = false;
+  undo_touched.clear();
+}
 
-  sleep(1);
+ProjFileTrack track_entry(Track* t, Instrument* i);
+void track_form(const char* form, const ProjFileTrack& pt, const char* path, int index, char* buf, int size);
+void journal_compact();
+
+// decimal digits of v; project files are mostly numbers, this is much
+// cheaper than a printf per field
+static void put_int(std::string& out, long v) {
+  char buf[24];
+  char* p = buf+sizeof(buf);
+  unsigned long u = v<0 ? -(unsigned long)v : v;
+  do {
+    *--p = '0'+u%10;
+    u /= 10;
+  } while (u);
+  if (v<0) *--p = '-';
+  out.append(p, buf+sizeof(buf)-p);
+}
 
-  // 1 second front padding
-  bounce_enabled = 1;
-  set_playhead(loop_start_point*bpm_factor*TMUL);
-  playback_enabled = 1;
+// (region id track instrument inpoint length)
+static void put_region(std::string& out, long id, long track, long instrument, long inpoint, long length) {
+  out += "(region ";
+  put_int(out, id);
+  out += ' ';
+  put_int(out, track);
+  out += ' ';
+  put_int(out, instrument);
+  out += ' ';
+  put_int(out, inpoint);
+  out += ' ';
+  put_int(out, length);
+  out += ')';
 }
 
-Cell* lisp_eval_dialog(Cell* args, Cell* env) {
-  char* expr = get_command_output("zenity --entry");
+static void put_region(std::string& out, uint32_t row) {
+  RegionStore& rs = region_store;
+  put_region(out, rs.id[row], rs.track_id[row], rs.instrument_id[row], rs.inpoint[row], rs.length[row]);
+}
 
-  if (expr && strlen(expr)>0) {
-    return eval(read_string(expr), get_globals());
+// journals the state after a step (redo) or after undoing it as one line,
+// (let () form ...), with tracks first like apply_undo_step()
+static void journal_step(UndoStep* st, bool redo) {
+  std::string line;
+  char buf[1024];
+
+  int n = st->tracks.size();
+  for (int k=0; k<n; k++) {
+    TrackDelta& d = st->tracks[redo ? k : n-1-k];
+    if (d.removed == redo) {
+      snprintf(buf,1023," (track-remove %d)",d.index);
+      line += buf;
+    } else if (d.instrument) {
+      line += " ";
+      track_form("track-insert", track_entry(d.track, d.instrument), d.instrument->path, d.index, buf, 1024);
+      line += buf;
+    }
   }
-  return alloc_nil();
-}
 
-Cell* lisp_err(char* msg) {
-  printf("%s\n",msg);
-  return alloc_nil();
-}
+  for (RegionDelta& d : st->regions) {
+    line += " (region-delete ";
+    put_int(line, d.before.id);
+    line += ')';
+    int row = region_row(region_by_id(d.before.id));
+    if (row<0 || !(redo ? d.exists : d.existed)) continue;
+    line += ' ';
+    put_region(line, row);
+  }
+
+  double b = redo ? st->bpm_after : st->bpm_before;
+  if (st->bpm_before != st->bpm_after) {
+    long h = lround(b*100);
+    snprintf(buf,1023," (bpm %ld %ld)",h/100,h%100);
+    line += buf;
+  }
+
+  if (!line.size()) return;
+  journal_append("(let ()"+line+")");
+  if (journal_size()>journal_compact_bytes) journal_compact();
+}
+
+static bool region_state_equal(const RegionState& a, const RegionState& b) {
+  return a.track==b.track && a.instrument==b.instrument && a.inpoint==b.inpoint && a.length==b.length;
+}
+
+void undo_end() {
+  if (!undo_depth || --undo_depth) return;
+
+  UndoStep* st = undo_current;
+  undo_current = NULL;
+  undo_touched.clear();
+  st->bpm_after = bpm;
+
+  // state after the edit, unchanged regions are dropped
+  int kept = 0;
+  for (RegionDelta& d : st->regions) {
+    int row = region_row(region_by_id(d.before.id));
+    d.exists = row>=0;
+    d.after.id = d.before.id;
+    if (d.exists) region_state(row, &d.after);
+
+    if (d.existed != d.exists || (d.exists && !region_state_equal(d.before, d.after))) {
+      st->regions[kept++] = d;
+    }
+  }
+  st->regions.resize(kept);
+  if (!undo_discard) journal_step(st, true);
+
+  bool bpm_only = !st->regions.size() && !st->tracks.size();
+  if (undo_discard || (bpm_only && st->bpm_before == st->bpm_after)) {
+    delete st;
+    return;
+  }
+
+  // dragging the bpm dialer is one edit
+  if (bpm_only && undo_steps.size()) {
+    UndoStep* last = undo_steps.back();
+    if (!last->regions.size() && !last->tracks.size() && last->bpm_after == st->bpm_before) {
+      last->bpm_after = st->bpm_after;
+      delete st;
+      return;
+    }
+  }
+
+  st->regions.shrink_to_fit();
+  st->tracks.shrink_to_fit();
+  undo_free_steps(redo_steps);
+  undo_steps.push_back(st);
+  undo_bytes += undo_step_bytes(st);
+
+  // the oldest steps go first, the newest one is always kept
+  int drop = 0;
+  while (undo_bytes>undo_budget && drop+1<undo_steps.size()) {
+    undo_bytes -= undo_step_bytes(undo_steps[drop]);
+    delete undo_steps[drop];
+    drop++;
+  }
+  undo_steps.erase(undo_steps.begin(), undo_steps.begin()+drop);
+}
+
+// forgets the history, e.g. when another project is loaded
+void undo_clear() {
+  undo_free_steps(undo_steps);
+  undo_free_steps(redo_steps);
+  if (undo_current) undo_discard = true;
+}
+
+static void undo_track_delta(Track* t, bool removed) {
+  if (!undo_current || undo_discard) return;
+  vector<Instrument*>& iv = active_project.instruments;
+  TrackDelta d = {t, t->id<iv.size() ? iv[t->id] : NULL, t->id, removed};
+  undo_current->tracks.push_back(d);
+}
+
+// call after appending a track and its instrument
+void undo_track_added(Track* t) {
+  undo_track_delta(t, false);
+}
+
+// track edits are replayed first so that the regions find their tracks
+static void apply_undo_step(UndoStep* st, bool redo) {
+  // the key press that triggered this is not an edit of its own
+  if (undo_current) undo_discard = true;
+  deselect_regions();
+
+  if (redo) {
+    for (TrackDelta& d : st->tracks) {
+      if (d.removed) track_remove(d.index);
+      else track_insert(d.index, d.track, d.instrument);
+    }
+  } else {
+    for (int i=st->tracks.size()-1; i>=0; i--) {
+      TrackDelta& d = st->tracks[i];
+      if (d.removed) track_insert(d.index, d.track, d.instrument);
+      else track_remove(d.index);
+    }
+  }
+
+  unordered_map<Instrument*, int> instruments;
+  for (int i=0; i<active_project.instruments.size(); i++) {
+    instruments[active_project.instruments[i]] = i;
+  }
+
+  // all regions in one pass over the store
+  vector<RegionRef> kill;
+  vector<RegionRow> put;
+  for (RegionDelta& d : st->regions) {
+    RegionRef h = region_by_id(d.before.id);
+    if (!(redo ? d.exists : d.existed)) {
+      kill.push_back(h);
+      continue;
+    }
+    RegionState& rst = redo ? d.after : d.before;
+    if (!rst.track) continue;
+    int iid = -1;
+    if (rst.instrument && instruments.count(rst.instrument)) iid = instruments[rst.instrument];
+
+    RegionRow row = {h, rst.id, rst.track->id, rst.inpoint, rst.length, iid};
+    put.push_back(row);
+  }
+  region_store_apply(kill, put);
+
+  bpm = redo ? st->bpm_after : st->bpm_before;
+  if (bpm_dialer) bpm_dialer->setValue(bpm);
+  journal_step(st, redo);
+
+  printf("%s: %s (%d regions, %d tracks)\n",redo ? "redo" : "undo",st->name,(int)st->regions.size(),(int)st->tracks.size());
+  mark_dirty(UI_ALL);
+}
+
+Cell* lisp_undo(Cell* args, Cell* env) {
+  if (!undo_steps.size()) return alloc_nil();
+  UndoStep* st = undo_steps.back();
+  undo_steps.pop_back();
+  apply_undo_step(st, false);
+  redo_steps.push_back(st);
+  return alloc_int(undo_steps.size());
+}
+
+Cell* lisp_redo(Cell* args, Cell* env) {
+  if (!redo_steps.size()) return alloc_nil();
+  UndoStep* st = redo_steps.back();
+  redo_steps.pop_back();
+  apply_undo_step(st, true);
+  undo_steps.push_back(st);
+  return alloc_int(redo_steps.size());
+}
+
+// (undo-budget [bytes]) -> bytes used by the history
+Cell* lisp_undo_budget(Cell* args, Cell* env) {
+  if (car(args) && car(args)->tag==TAG_INT && car(args)->value>0) {
+    undo_budget = car(args)->value;
+  }
+  return alloc_int(undo_bytes);
+}
+
+Cell* delete_selected_tracks(Cell* args, Cell* env) {
+
+  deselect_regions();
+  if (selected_track) {
+    undo_track_delta(selected_track, true);
+    track_remove(selected_track->id);
+  }
+
+  selected_track = NULL;
+  mark_dirty(UI_TRACKS);
+}
+
+Cell* add_midi_octave(Cell* args, Cell* env) {
+  int octave = 3;
+  int port = 0;
+  int channel = 1;
+
+  if (car(args) && car(args)->tag == TAG_INT) {
+    octave = car(args)->value;
+
+    args = cdr(args);
+    if (car(args) && car(args)->tag == TAG_INT) {
+      port = car(args)->value;
+    }
+  }
+  
+  int note = octave*12;
+  
+  for (int i=0; i<12; i++) {
+    int r = 0;
+    int g = 7;
+    int b = (2+2*port)%10;
+    
+    char name[64];
+    sprintf(name,"M%d N%d",channel,note);
+    
+    int id = active_project.tracks.size();
+    
+    Track* t = new Track {id, TRACK_MIDI, name, r, g, b};  
+    active_project.tracks.push_back(t);
+
+    // make instrument
+
+    Instrument* instr = new Instrument {id, I_MIDI, name, "", note, port, channel};
+    active_project.instruments.push_back(instr);
+    undo_track_added(t);
+    
+    note++;
+  }
+  mark_dirty(UI_TRACKS);
+  return alloc_nil();
+}
+
+Cell* bounce_loop(Cell* args, Cell* env) {
+  float bpm_factor = 240.0/bpm;
+    
+  playback_enabled = 0;
+  playback_clean_up = 1;
+  
+  char buf[1024];
+  // 2 seconds padding
+  long seconds = 2+((loop_end_point-loop_start_point)/250.0)/bpm*60;
+  
+  sprintf(buf,"jack_capture -z 2 -d %ld &", seconds);
+  printf("bouncing using: %s\n",buf);
+
+  system(buf);
+
+  sleep(1);
+
+  // 1 second front padding
+  bounce_enabled = 1;
+  set_playhead(loop_start_point*bpm_factor*TMUL);
+  playback_enabled = 1;
+}
+
+Cell* lisp_eval_dialog(Cell* args, Cell* env) {
+  char* expr = get_command_output("zenity --entry");
+
+  if (expr && strlen(expr)>0) {
+    return eval(read_string(expr), get_globals());
+  }
+  return alloc_nil();
+}
+
+Cell* lisp_err(char* msg) {
+  printf("%s\n",msg);
+  return alloc_nil();
+}
 
 Cell* add_region(Cell* args, Cell* env) {
   /*
@@ -1339,13 +3028,13 @@ Cell* add_region(Cell* args, Cell* env) {
                       
   args=cdr(args);
   if (!car(args) || car(args)->tag!=TAG_INT) return lisp_err("(region-sample) invalid param #3 (inpoint)");  
-  int inpoint = car(args)->value;
+  long inpoint = car(args)->value;
  
   args=cdr(args);
   if (!car(args) || car(args)->tag!=TAG_INT) return lisp_err("(region-sample) invalid param #4 (duration)");  
-  int duration = car(args)->value;
+  long duration = car(args)->value;
 
-  Track* track;
+  Track* track = NULL;
   for (Track* t : active_project.tracks) {
     if (t->id == track_id) track = t;
   }
@@ -1354,19 +3043,225 @@ Cell* add_region(Cell* args, Cell* env) {
     return alloc_nil();
   }
 
-  // FIXME: region ids are all 1
-  //printf("add_region: %d\n",id);
+  region_add(track_id, inpoint, duration, sample_id, id);
+  mark_track_dirty(track);
+  
+  return alloc_nil();
+}
+
+const char* automation_type_names[] = {"cc", "bend", "program"};
+
+int parse_automation_type(Cell* c) {
+  if (!c || c->tag!=TAG_STR) return -1;
+  for (int i=0; i<3; i++) {
+    if (!strcmp((char*)c->addr, automation_type_names[i])) return i;
+  }
+  return -1;
+}
+
+Track* find_track(int track_id) {
+  for (Track* t : active_project.tracks) {
+    if (t->id == track_id) return t;
+  }
+  return NULL;
+}
+
+AutomationLane* find_automation_lane(Track* t, automation_type_t type, int controller, bool create) {
+  if (type != A_CC) controller = 0;
+  
+  for (AutomationLane* lane : t->automation) {
+    if (lane->type == type && lane->controller == controller) return lane;
+  }
+  if (!create) return NULL;
+
+  AutomationLane* lane = new AutomationLane {type, controller};
+  lane->cursor = 0;
+  lane->last_value = -1;
+  lane->last_sent_smp = 0;
+  t->automation.push_back(lane);
+  return lane;
+}
+
+int clamp_automation_value(automation_type_t type, int value) {
+  int top = (type == A_PITCH_BEND) ? 16383 : 127;
+  if (value<0) return 0;
+  if (value>top) return top;
+  return value;
+}
+
+void set_automation_point(AutomationLane* lane, int32_t time, int value) {
+  vector<int32_t>& ts = lane->times;
+  int idx = lower_bound(ts.begin(), ts.end(), time) - ts.begin();
+  value = clamp_automation_value(lane->type, value);
+
+  if (idx<ts.size() && ts[idx] == time) {
+    lane->values[idx] = value;
+  } else {
+    ts.insert(ts.begin()+idx, time);
+    lane->values.insert(lane->values.begin()+idx, value);
+  }
+}
+
+// (region-delete id)
+Cell* lisp_region_delete(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_INT) return lisp_err("(region-delete) invalid param #0 (id)");
+  RegionRef h = region_by_id(car(args)->value);
+  int row = region_row(h);
+  if (row<0) return alloc_nil();
+
+  Track* t = find_track(region_store.track_id[row]);
+  region_delete(h);
+  if (t) mark_track_dirty(t);
+  return alloc_int(1);
+}
+
+// (track-remove index) deletes the track with its regions
+Cell* lisp_track_remove(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_INT) return lisp_err("(track-remove) invalid param #0 (index)");
+  Track* t = find_track(car(args)->value);
+  if (!t) return lisp_err("(track-remove) invalid track id");
+
+  deselect_regions();
+  undo_track_delta(t, true);
+  track_remove(t->id);
+  return alloc_nil();
+}
+
+// (bpm [beats hundredths]) -> whole beats per minute
+Cell* lisp_bpm(Cell* args, Cell* env) {
+  if (car(args) && car(args)->tag==TAG_INT && car(args)->value>0) {
+    bpm = car(args)->value;
+    if (car(cdr(args)) && car(cdr(args))->tag==TAG_INT) bpm += car(cdr(args))->value/100.0;
+    if (bpm_dialer) bpm_dialer->setValue(bpm);
+    mark_dirty(UI_VIEWPORT|UI_LOOP|UI_PLAYHEAD|UI_LANES);
+  }
+  return alloc_int((int)bpm);
+}
+
+// parses the common (... track-id "cc"|"bend"|"program" controller ...) head
+// of the automation functions. returns the remaining args or NULL.
+Cell* parse_automation_head(Cell* args, Track** t, automation_type_t* type, int* controller) {
+  if (!car(args) || car(args)->tag!=TAG_INT) { lisp_err("(automation) invalid param #0 (track_id)"); return NULL; }
+  *t = find_track(car(args)->value);
+  if (!*t) { lisp_err("(automation) invalid track id"); return NULL; }
+
+  args = cdr(args);
+  int ty = parse_automation_type(car(args));
+  if (ty<0) { lisp_err("(automation) invalid param #1 (type: \"cc\", \"bend\" or \"program\")"); return NULL; }
+  *type = (automation_type_t)ty;
+
+  args = cdr(args);
+  if (!car(args) || car(args)->tag!=TAG_INT) { lisp_err("(automation) invalid param #2 (controller)"); return NULL; }
+  *controller = car(args)->value;
+
+  return cdr(args);
+}
+
+// (automation track-id "cc" 74 time value time value ...)
+// replaces the breakpoints of a lane; controller is ignored for "bend" and "program"
+Cell* lisp_automation(Cell* args, Cell* env) {
+  Track* t;
+  automation_type_t type;
+  int controller;
+
+  args = parse_automation_head(args, &t, &type, &controller);
+  if (!args) return alloc_nil();
+
+  AutomationLane* lane = find_automation_lane(t, type, controller, true);
+  lane->times.clear();
+  lane->values.clear();
   
-  MPRegion* r = new MPRegion {id,
-              track_id,
-              inpoint,
-              duration,
-              sample_id};
-  track->regions.push_back(r);
+  while (car(args) && car(cdr(args))) {
+    Cell* time = car(args);
+    Cell* value = car(cdr(args));
+    if (time->tag!=TAG_INT || value->tag!=TAG_INT) return lisp_err("(automation) breakpoints must be time value pairs");
+    
+    set_automation_point(lane, time->value, value->value);
+    args = cdr(cdr(args));
+  }
+  schedule_stale = true;
+
+  return alloc_int(lane->times.size());
+}
+
+// (automation-point track-id "cc" 74 time value)
+Cell* lisp_automation_point(Cell* args, Cell* env) {
+  Track* t;
+  automation_type_t type;
+  int controller;
+
+  args = parse_automation_head(args, &t, &type, &controller);
+  if (!args) return alloc_nil();
   
+  if (!car(args) || car(args)->tag!=TAG_INT) return lisp_err("(automation-point) invalid param #3 (time)");
+  int time = car(args)->value;
+  args = cdr(args);
+  if (!car(args) || car(args)->tag!=TAG_INT) return lisp_err("(automation-point) invalid param #4 (value)");
+  int value = car(args)->value;
+
+  AutomationLane* lane = find_automation_lane(t, type, controller, true);
+  set_automation_point(lane, time, value);
+  schedule_stale = true;
+
+  return alloc_int(lane->times.size());
+}
+
+// (automation-clear track-id)
+// the jack thread plays its own copies of the lanes, so they can go right away
+Cell* lisp_automation_clear(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_INT) return lisp_err("(automation-clear) invalid param #0 (track_id)");
+  Track* t = find_track(car(args)->value);
+  if (t) {
+    for (AutomationLane* lane : t->automation) {
+      delete lane;
+    }
+    t->automation.clear();
+    schedule_stale = true;
+  }
   return alloc_nil();
 }
 
+// (automation-thinning min-frames min-delta) -> events dropped so far by a full queue
+Cell* lisp_automation_thinning(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_INT) return lisp_err("(automation-thinning) invalid param #0 (min-frames)");
+  automation_min_frames = car(args)->value;
+  
+  args = cdr(args);
+  if (car(args) && car(args)->tag==TAG_INT) {
+    automation_min_delta = car(args)->value;
+  }
+  return alloc_int(automation_dropped.load(std::memory_order_relaxed));
+}
+
+Cell* alloc_lisp_string(const char* str) {
+  Cell* c = alloc_string();
+  free(c->addr);
+  c->addr = strdup(str);
+  c->size = strlen(str);
+  return c;
+}
+
+Cell* lisp_all_automation(Cell* args, Cell* env) {
+  Cell* r_list = alloc_nil();
+  for (Track* t : active_project.tracks) {
+    for (AutomationLane* lane : t->automation) {
+      // build (automation id "type" controller t v t v ...) back to front
+      Cell* form = alloc_nil();
+      for (int i=lane->times.size()-1; i>=0; i--) {
+        form = alloc_cons(alloc_int(lane->values[i]), form);
+        form = alloc_cons(alloc_int(lane->times[i]), form);
+      }
+      form = alloc_cons(alloc_int(lane->controller), form);
+      form = alloc_cons(alloc_lisp_string(automation_type_names[lane->type]), form);
+      form = alloc_cons(alloc_int(t->id), form);
+      form = alloc_cons(alloc_sym("automation"), form);
+      
+      r_list = append(form, r_list);
+    }
+  }
+  return r_list;
+}
+
 Cell* lisp_dump(Cell* expr, Cell* env) {
   char buf[1024];
   lisp_write(car(expr), buf, 1024);
@@ -1374,16 +3269,29 @@ Cell* lisp_dump(Cell* expr, Cell* env) {
   return alloc_nil();
 }
 
+// (head v0 v1 ...) built from cells, without printing and reading it back
+Cell* int_form(const char* head, const long* values, int n) {
+  Cell* form = alloc_nil();
+  for (int i=n-1; i>=0; i--) {
+    form = alloc_cons(alloc_int(values[i]), form);
+  }
+  return alloc_cons(alloc_sym((char*)head), form);
+}
+
 Cell* lisp_all_instruments(Cell* args, Cell* env) {
   Cell* r_list = alloc_nil();
   for (Instrument* i : active_project.instruments) {
-    char buf[1024];
+    Cell* r_cell;
     if (i->type == I_SAMPLE) {
-      snprintf(buf,1023,"(instrument %d %d \"%s\")",i->id,i->type,i->path);
+      // (instrument id type "path")
+      r_cell = alloc_cons(alloc_lisp_string(i->path), alloc_nil());
+      r_cell = alloc_cons(alloc_int(i->type), r_cell);
+      r_cell = alloc_cons(alloc_int(i->id), r_cell);
+      r_cell = alloc_cons(alloc_sym("instrument"), r_cell);
     } else {
-      snprintf(buf,1023,"(instrument %d %d %d %d %d)",i->id,i->type,i->note,i->midi_port,i->midi_channel);
+      long v[] = {i->id, i->type, i->note, i->midi_port, i->midi_channel};
+      r_cell = int_form("instrument", v, 5);
     }
-    Cell* r_cell = read_string(buf);
     r_list = append(r_cell, r_list);
   }
   return r_list;
@@ -1392,9 +3300,10 @@ Cell* lisp_all_instruments(Cell* args, Cell* env) {
 Cell* lisp_all_tracks(Cell* args, Cell* env) {
   Cell* r_list = alloc_nil();
   for (Track* t : active_project.tracks) {
-    char buf[1024];
-    snprintf(buf,1023,"(track %d \"%s\" %d %d %d)",t->id,t->title.c_str(),t->r,t->g,t->b);
-    Cell* r_cell = read_string(buf);
+    long v[] = {t->r, t->g, t->b};
+    Cell* r_cell = int_form("track", v, 3);
+    // (track id "title" r g b)
+    r_cell->next = alloc_cons(alloc_int(t->id), alloc_cons(alloc_lisp_string(t->title.c_str()), (Cell*)r_cell->next));
     r_list = append(r_cell, r_list);
   }
   return r_list;
@@ -1402,60 +3311,432 @@ Cell* lisp_all_tracks(Cell* args, Cell* env) {
 
 Cell* lisp_all_regions(Cell* args, Cell* env) {
   Cell* r_list = alloc_nil();
-  for (Track* t : active_project.tracks) {
-    for (MPRegion* r : t->regions) {
-      char buf[1024];
-      snprintf(buf,1023,"(region %d %d %d %d %d)",r->id,r->track_id,r->instrument_id,r->inpoint,r->length);
-      Cell* r_cell = read_string(buf);
-      r_list = append(r_cell, r_list);
-    }
+  RegionStore& rs = region_store;
+  for (uint32_t r=0; r<rs.id.size(); r++) {
+    long v[] = {rs.id[r], rs.track_id[r], rs.instrument_id[r], rs.inpoint[r], rs.length[r]};
+    r_list = append(int_form("region", v, 5), r_list);
   }
   return r_list;
 }
 
+// the instrument and look of a track as the project files keep it
+ProjFileTrack track_entry(Track* t, Instrument* i) {
+  ProjFileTrack pt;
+  memset(&pt, 0, sizeof(pt));
+  pt.type = t->type;
+  if (t->type == TRACK_MIDI) {
+    pt.note = i->note;
+    pt.midi_port = i->midi_port;
+    pt.midi_channel = i->midi_channel;
+  }
+  pt.r = t->r;
+  pt.g = t->g;
+  pt.b = t->b;
+  return pt;
+}
+
+// (form index path ...) with form "track" or "track-insert"
+void track_form(const char* form, const ProjFileTrack& pt, const char* path, int index, char* buf, int size) {
+  if (pt.type == TRACK_MIDI) {
+    snprintf(buf,size,"(%s %d \"%s\" %d %d %d %d %d %d)",form,index,"midi",pt.note,pt.midi_port,pt.midi_channel,pt.r,pt.g,pt.b);
+  } else {
+    snprintf(buf,size,"(%s %d \"%s\" %d %d %d)",form,index,path,pt.r,pt.g,pt.b);
+  }
+}
+
+// copies the project into d, the contents of both project file formats
+void project_data(ProjFileData& d) {
+  RegionStore& rs = region_store;
+  d.bpm = bpm;
+  d.add_string(""); // offset 0, the path of MIDI tracks
+
+  for (int c=0; c<active_project.tracks.size(); c++) {
+    Track* t = active_project.tracks[c];
+    Instrument* i = active_project.instruments[c];
+
+    ProjFileTrack pt = track_entry(t, i);
+    if (t->type != TRACK_MIDI) pt.path = d.add_string(i->path);
+    pt.num_regions = track_rows_end(c)-track_rows_begin(c);
+    pt.num_lanes = t->automation.size();
+    d.tracks.push_back(pt);
+
+    uint32_t b = track_rows_begin(c), e = track_rows_end(c);
+    d.region_id.insert(d.region_id.end(), rs.id.begin()+b, rs.id.begin()+e);
+    d.region_instrument.insert(d.region_instrument.end(), rs.instrument_id.begin()+b, rs.instrument_id.begin()+e);
+    d.region_inpoint.insert(d.region_inpoint.end(), rs.inpoint.begin()+b, rs.inpoint.begin()+e);
+    d.region_length.insert(d.region_length.end(), rs.length.begin()+b, rs.length.begin()+e);
+
+    for (AutomationLane* lane : t->automation) {
+      ProjFileLane pl = {(uint32_t)lane->type, lane->controller, (uint32_t)lane->times.size(), 0};
+      d.lanes.push_back(pl);
+      d.point_time.insert(d.point_time.end(), lane->times.begin(), lane->times.end());
+      d.point_value.insert(d.point_value.end(), lane->values.begin(), lane->values.end());
+    }
+  }
+}
+
+// the forms that rebuild the project in d, one per line. touches no live
+// state, so it can run on another thread.
+void project_data_forms(const ProjFileData& d, std::string& out) {
+  char buf[1024];
+  out.reserve(out.size()+d.region_id.size()*40+4096);
+
+  long h = lround(d.bpm*100);
+  snprintf(buf,1023,"(bpm %ld %ld)\n",h/100,h%100);
+  out += buf;
+
+  uint32_t r = 0, l = 0, p = 0;
+  for (int c=0; c<d.tracks.size(); c++) {
+    const ProjFileTrack& pt = d.tracks[c];
+
+    out += "\n";
+    track_form("track", pt, d.strings.c_str()+pt.path, c, buf, 1023);
+    out += buf;
+    out += "\n";
+
+    for (uint32_t e=r+pt.num_regions; r<e; r++) {
+      put_region(out, d.region_id[r], c, d.region_instrument[r], d.region_inpoint[r], d.region_length[r]);
+      out += '\n';
+    }
+
+    for (uint32_t e=l+pt.num_lanes; l<e; l++) {
+      const ProjFileLane& pl = d.lanes[l];
+      snprintf(buf,1023,"(automation %d \"%s\" %d",c,automation_type_names[pl.type],pl.controller);
+      out += buf;
+      for (uint32_t f=p+pl.num_points; p<f; p++) {
+        out += ' ';
+        put_int(out, d.point_time[p]);
+        out += ' ';
+        put_int(out, d.point_value[p]);
+      }
+      out += ")\n";
+    }
+  }
+}
+
+// the forms that rebuild the project, one per line
+void project_forms(std::string& out) {
+  ProjFileData d;
+  project_data(d);
+  project_data_forms(d, out);
+}
+
+// the file is built in memory and written to a temporary file first, so a
+// failed or interrupted save leaves the previous project intact
 Cell* lisp_save_project(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_STR) return lisp_err("(project-save) invalid param #0 (path)");
   char* path = (char*)(car(args)->addr);
-  FILE* f = fopen(path,"wb");
+  double t0 = uistats_now_ms();
 
-  char buf[1024];
+  std::string out = "(let (project-version 1) \n";
+  project_forms(out);
+  out += ")\n";
 
-  printf("writing project to %s\n",path);
-  
-  if (f) {
-    sprintf(buf,"(let (project-version 1) \n");
-    fwrite(buf, 1, strlen(buf), f);
-  
-    /*for (Instrument* i : active_project.instruments) {
-      if (i->type == I_SAMPLE) {
-        sprintf(buf,"(instrument %d %d \"%s\")\n",i->id,i->type,i->path);
-      } else {
-        sprintf(buf,"(instrument %d %d %d %d %d)\n",i->id,i->type,i->note,i->midi_port,i->midi_channel);
+  std::string tmp = std::string(path)+".tmp";
+  FILE* f = fopen(tmp.c_str(),"wb");
+  if (!f) {
+    printf("cannot write %s\n",tmp.c_str());
+    return alloc_int(0);
+  }
+  // synced before the rename, the journal is reset to this file right after
+  int ok = fwrite(out.data(), 1, out.size(), f)==out.size() && !fflush(f) && !fsync(fileno(f));
+  if (fclose(f)) ok = 0;
+  if (!ok || rename(tmp.c_str(), path)) {
+    printf("cannot write %s\n",path);
+    remove(tmp.c_str());
+    return alloc_int(0);
+  }
+
+  printf("wrote project to %s: %d regions, %d bytes in %.1fms\n",path,(int)region_store.id.size(),(int)out.size(),uistats_now_ms()-t0);
+
+  // the saved file is the new base of the journal
+  journal_start(path, 1);
+  return alloc_int(1);
+}
+
+// (project-save-binary path) writes the project as a binary snapshot, see projfile.h.
+// it holds the same as the lisp file, so the two convert into each other.
+Cell* lisp_save_project_binary(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_STR) return lisp_err("(project-save-binary) invalid param #0 (path)");
+  char* path = (char*)(car(args)->addr);
+
+  ProjFileData d;
+  project_data(d);
+
+  printf("writing binary project to %s\n",path);
+  if (!projfile_write(path, d)) return alloc_int(0);
+
+  journal_start(path, 1);
+  return alloc_int(1);
+}
+
+void project_clear();
+
+// loads a snapshot written by (project-save-binary). the regions go into the
+// store as whole columns instead of one (region) call each. returns 0 and
+// leaves the project alone if path is not a valid snapshot.
+int project_load_binary(const char* path) {
+  ProjFile pf;
+  if (!projfile_open(path, &pf)) return 0;
+
+  double t0 = uistats_now_ms();
+  project_clear();
+
+  const ProjFileHeader* h = pf.header;
+  vector<uint32_t> counts(h->num_tracks);
+  uint32_t p = 0;
+  uint32_t l = 0;
+  for (uint32_t c=0; c<h->num_tracks; c++) {
+    const ProjFileTrack& pt = pf.tracks[c];
+    Track* t;
+    if (pt.type == TRACK_MIDI) {
+      t = track_add(-1, "midi", pt.note, pt.midi_port, pt.midi_channel, pt.r, pt.g, pt.b);
+    } else {
+      t = track_add(-1, strdup(pf.strings+pt.path), 0, 0, 0, pt.r, pt.g, pt.b);
+    }
+    counts[c] = pt.num_regions;
+
+    for (uint32_t k=0; k<pt.num_lanes; k++, l++) {
+      const ProjFileLane& pl = pf.lanes[l];
+      AutomationLane* lane = find_automation_lane(t, (automation_type_t)pl.type, pl.controller, true);
+      lane->times.assign(pf.point_time+p, pf.point_time+p+pl.num_points);
+      lane->values.resize(pl.num_points);
+      for (uint32_t j=0; j<pl.num_points; j++) {
+        lane->values[j] = clamp_automation_value(lane->type, pf.point_value[p+j]);
       }
-      fwrite(buf, 1, strlen(buf), f);
-      }*/
+      p += pl.num_points;
+    }
+  }
+  region_store_assign(counts.data(), h->num_tracks, pf.region_id, pf.region_instrument, pf.region_inpoint, pf.region_length);
 
-    int c = 0;
-    for (Track* t : active_project.tracks) {
-      Instrument* i = active_project.instruments[c];
-      
-      if (t->type == TRACK_MIDI) {
-        sprintf(buf, "\n(track %d \"%s\" %d %d %d %d %d %d)\n",t->id,"midi",i->note,i->midi_port,i->midi_channel,t->r,t->g,t->b);
-      } else {
-        sprintf(buf, "\n(track %d \"%s\" %d %d %d)\n",t->id,i->path,t->r,t->g,t->b);
+  bpm = h->bpm;
+  if (bpm_dialer) bpm_dialer->setValue(bpm);
+  mark_dirty(UI_ALL);
+
+  printf("loaded %s: %d tracks, %d regions in %.1fms\n",path,h->num_tracks,h->num_regions,uistats_now_ms()-t0);
+  projfile_close(&pf);
+  return 1;
+}
+
+// (project-load-binary path) -> 1 if path was a binary snapshot and is loaded
+Cell* lisp_load_project_binary(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_STR) return lisp_err("(project-load-binary) invalid param #0 (path)");
+  return alloc_int(project_load_binary((char*)car(args)->addr));
+}
+
+// replaces the journal with the whole project; runs when it has grown past
+// journal_compact_bytes. only the copy of the project is made here, the
+// journal writer turns it into lines.
+void journal_compact() {
+  std::shared_ptr<ProjFileData> d(new ProjFileData);
+  project_data(*d);
+  journal_snapshot([d](std::string& lines) { project_data_forms(*d, lines); });
+}
+
+// (journal-compact [bytes]) compacts now; bytes sets the size at which the
+// journal is compacted automatically
+Cell* lisp_journal_compact(Cell* args, Cell* env) {
+  if (car(args) && car(args)->tag==TAG_INT && car(args)->value>0) {
+    journal_compact_bytes = car(args)->value;
+  }
+  journal_compact();
+  return alloc_int(journal_compact_bytes);
+}
+
+// (journal-open path) starts a new journal of edits on top of the saved project
+// at path, dropping the old one. (project-load) replays that one first.
+Cell* lisp_journal_open(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_STR) return lisp_err("(journal-open) invalid param #0 (path)");
+  journal_start((char*)car(args)->addr, 1);
+  return alloc_nil();
+}
+
+// region units: 1000 = 1 bar, so a quarter note is 250.
+// region lengths count double (see the FIXME in jack_process_callback).
+#define SMF_EXPORT_DIVISION 480
+
+struct ImportedNote {
+  int channel;
+  int note;
+  uint32_t start;
+  uint32_t end;
+};
+
+// (midi-import "file.mid" [port])
+// creates one MIDI track per used channel/note pair and a region per note
+Cell* lisp_midi_import(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_STR) return lisp_err("(midi-import) invalid param #0 (path)");
+  char* path = (char*)car(args)->addr;
+
+  int port = 0;
+  args = cdr(args);
+  if (car(args) && car(args)->tag==TAG_INT) port = car(args)->value;
+
+  SMFFile smf;
+  if (!smf_open(path, &smf)) return alloc_nil();
+
+  vector<ImportedNote> notes;
+  notes.reserve(smf.size/8);
+  double file_bpm = 0;
+
+  static int32_t note_on_tick[16][128];
+  SMFTrackReader rd;
+  SMFEvent ev;
+  int track = 0;
+  
+  while (smf_next_track(&smf, &rd)) {
+    memset(note_on_tick, 0xff, sizeof(note_on_tick));
+    
+    int got;
+    while ((got = smf_next_event(&rd, &ev))>0) {
+      int type = ev.status&0xf0;
+      int ch = ev.status&0x0f;
+
+      if (ev.status == 0xff) {
+        if (ev.meta_type == SMF_META_TEMPO && ev.payload_len == 3 && !file_bpm) {
+          uint32_t usec = (ev.payload[0]<<16) | (ev.payload[1]<<8) | ev.payload[2];
+          if (usec) file_bpm = 60000000.0/usec;
+        }
+      } else if (type == 0x90 || type == 0x80) {
+        int32_t& on = note_on_tick[ch][ev.data1];
+        if (on>=0) {
+          notes.push_back(ImportedNote {ch, ev.data1, (uint32_t)on, ev.tick});
+          on = -1;
+        }
+        if (type == 0x90 && ev.data2>0) on = ev.tick;
       }
-      fwrite(buf, 1, strlen(buf), f);
-      
-      for (MPRegion* r : t->regions) {
-        sprintf(buf,"(region %d %d %d %d %d)\n",r->id,r->track_id,r->instrument_id,r->inpoint,r->length);
-        fwrite(buf, 1, strlen(buf), f);
+    }
+    if (got == SMF_ERROR) {
+      printf("midi-import: %s: track %d is broken after tick %u, skipping the rest of it\n",path,track,rd.tick);
+    }
+    track++;
+
+    // close hanging notes at the end of their track
+    for (int ch=0; ch<16; ch++) {
+      for (int n=0; n<128; n++) {
+        if (note_on_tick[ch][n]>=0) {
+          notes.push_back(ImportedNote {ch, n, (uint32_t)note_on_tick[ch][n], rd.tick});
+        }
       }
-      c++;
     }
+  }
+
+  double units_per_tick = 250.0/smf.division;
+  smf_close(&smf);
+
+  // one track per used channel/note, ordered by channel and pitch
+  static int key_track[16*128];
+  for (int k=0; k<16*128; k++) key_track[k] = -1;
+  for (ImportedNote& n : notes) key_track[n.channel*128+n.note] = 0;
   
-    sprintf(buf,")\n");
-    fwrite(buf, 1, strlen(buf), f);
-    fclose(f);
+  for (int k=0; k<16*128; k++) {
+    if (key_track[k]<0) continue;
+
+    int channel = k/128+1;
+    int note = k%128;
+    int id = active_project.tracks.size();
+    
+    char name[64];
+    sprintf(name,"M%d N%d",channel,note);
+
+    Track* t = new Track {id, TRACK_MIDI, name, 0, 7, (2+2*channel)%10};
+    active_project.tracks.push_back(t);
+
+    Instrument* instr = new Instrument {id, I_MIDI, strdup(name), "", note, port, channel};
+    active_project.instruments.push_back(instr);
+    undo_track_added(t);
+
+    key_track[k] = id;
+  }
+
+  // all notes go into the store in one sorted merge
+  vector<RegionRow> rows;
+  rows.reserve(notes.size());
+  for (ImportedNote& n : notes) {
+    int track_id = key_track[n.channel*128+n.note];
+    long inpoint = lround(n.start*units_per_tick);
+    long length = lround(2*(n.end-n.start)*units_per_tick);
+    if (length<1) length = 1;
+
+    RegionRow row = {NO_REGION, 0, track_id, inpoint, length, track_id};
+    rows.push_back(row);
+  }
+  region_store_apply(vector<RegionRef>(), rows);
+
+  if (file_bpm>0) {
+    bpm = file_bpm;
+    if (bpm_dialer) bpm_dialer->setValue(bpm);
+  }
+  mark_dirty(UI_ALL);
+  
+  printf("midi-import: %s: %d notes, bpm %f\n",path,(int)notes.size(),bpm);
+  return alloc_int(notes.size());
+}
+
+struct ExportEvent {
+  uint32_t tick;
+  uint8_t data[3];
+};
+
+bool export_event_before(const ExportEvent& a, const ExportEvent& b) {
+  if (a.tick != b.tick) return a.tick < b.tick;
+  // note offs first so that back-to-back notes don't cut each other
+  return (a.data[0]&0xf0) < (b.data[0]&0xf0);
+}
+
+// (midi-export "file.mid")
+// writes a type 1 file with a tempo track and one track per produce MIDI track
+Cell* lisp_midi_export(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_STR) return lisp_err("(midi-export) invalid param #0 (path)");
+  char* path = (char*)car(args)->addr;
+
+  int num_midi_tracks = 0;
+  for (Track* t : active_project.tracks) {
+    if (t->type == TRACK_MIDI) num_midi_tracks++;
+  }
+
+  SMFWriter w;
+  smf_write_header(&w, 1, num_midi_tracks+1, SMF_EXPORT_DIVISION);
+  
+  smf_write_begin_track(&w);
+  smf_write_tempo(&w, 0, bpm);
+  smf_write_end_track(&w);
+
+  double ticks_per_unit = SMF_EXPORT_DIVISION/250.0;
+  vector<ExportEvent> events;
+  int num_notes = 0;
+  
+  for (Track* t : active_project.tracks) {
+    if (t->type != TRACK_MIDI) continue;
+
+    events.clear();
+    RegionStore& rs = region_store;
+    for (uint32_t r=track_rows_begin(t->id); r<track_rows_end(t->id); r++) {
+      if (rs.instrument_id[r]<0 || rs.instrument_id[r]>=active_project.instruments.size()) continue;
+      Instrument* instr = active_project.instruments[rs.instrument_id[r]];
+      if (instr->type != I_MIDI) continue;
+
+      unsigned char ch = midi_channel_bits(instr->midi_channel);
+      uint32_t start = rs.inpoint[r]>0 ? lround(rs.inpoint[r]*ticks_per_unit) : 0;
+      uint32_t end = start + lround(rs.length[r]/2.0*ticks_per_unit);
+      
+      events.push_back(ExportEvent {start, {(uint8_t)(MIDI_NOTE_ON+ch), (uint8_t)instr->note, 127}});
+      events.push_back(ExportEvent {end, {(uint8_t)(MIDI_NOTE_OFF+ch), (uint8_t)instr->note, 0}});
+      num_notes++;
+    }
+    sort(events.begin(), events.end(), export_event_before);
+
+    smf_write_begin_track(&w);
+    for (ExportEvent& e : events) {
+      smf_write_event(&w, e.tick, e.data, 3);
+    }
+    smf_write_end_track(&w);
   }
+
+  if (!smf_write_file(&w, path)) return alloc_nil();
+
+  printf("midi-export: %s: %d notes\n",path,num_notes);
+  return alloc_int(num_notes);
 }
 
 void file_dropped_callback(char* uri_raw) {
@@ -1521,9 +3802,13 @@ struct Instrument {
     };
     make_track_label(t);
     
+    undo_begin("drop file");
     active_project.tracks.push_back(t);
+    undo_track_added(t);
+    mark_dirty(UI_TRACKS);
     
     eval(read_string(buf), get_globals());
+    undo_end();
   }
 }
 
@@ -1535,25 +3820,150 @@ Cell* lisp_project_path(Cell* args, Cell* env) {
   return c;
 }
 
+// (ui-stats) -> (("frames" n) ("frame-us" n) ...), times in microseconds
+Cell* lisp_ui_stats(Cell* args, Cell* env) {
+  const char* names[] = {
+    "frames", "frame-us", "frame-avg-us", "frame-max-us", "frame-p95-us", "frame-p99-us",
+    "views-visited", "views-drawn", "draw-calls",
+    "update-ui-us", "update-ui-max-us", "evals", "eval-us", "eval-max-us"
+  };
+  UIStats& s = ui_stats;
+  int64_t values[] = {
+    s.frames,
+    (int64_t)(s.frame_ms[(s.frames+UISTATS_HISTORY-1)%UISTATS_HISTORY]*1000),
+    (int64_t)(s.frames ? s.frame_total_ms*1000/s.frames : 0),
+    (int64_t)(s.frame_max_ms*1000),
+    (int64_t)(uistats_frame_percentile(95)*1000),
+    (int64_t)(uistats_frame_percentile(99)*1000),
+    s.views_visited, s.views_drawn, s.draw_calls,
+    (int64_t)(s.update_ui_ms*1000), (int64_t)(s.update_ui_max_ms*1000),
+    s.evals, (int64_t)(s.eval_ms*1000), (int64_t)(s.eval_max_ms*1000)
+  };
+
+  Cell* r_list = alloc_nil();
+  for (int i=sizeof(values)/sizeof(values[0])-1; i>=0; i--) {
+    Cell* pair = alloc_cons(alloc_lisp_string(names[i]), alloc_cons(alloc_int(values[i]), alloc_nil()));
+    r_list = alloc_cons(pair, r_list);
+  }
+  return r_list;
+}
+
+Cell* lisp_ui_stats_reset(Cell* args, Cell* env) {
+  uistats_reset();
+  return alloc_nil();
+}
+
+Cell* lisp_toggle_ui_stats(Cell* args, Cell* env) {
+  if (!stats_overlay) {
+    stats_overlay = new UIStatsOverlay(Rect(glv_root.width()-610, 60, 600, 300));
+    stats_overlay->anchor(1, 0); // stays in the top right corner when the window is resized
+    stats_overlay->disable(Visible);
+    glv_root << *stats_overlay;
+  }
+  stats_overlay->toggle(Visible);
+  stats_overlay->makeLastSibling(); // on top of views created later
+  glv_root.refresh();
+  return alloc_int(stats_overlay->visible() ? 1 : 0);
+}
+
+Cell* eval_lisp_file(char* filename);
+
+// (eval-file path) evaluates the forms of a lisp file while reading it
+Cell* lisp_eval_file(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_STR) return lisp_err("(eval-file) invalid param #0 (path)");
+  return eval_lisp_file((char*)car(args)->addr);
+}
+
+// removes all tracks and regions and forgets the history. the tracks are
+// dropped as a whole instead of one track_remove() each.
+void project_clear() {
+  undo_clear();
+  region_store_clear();
+
+  for (Track* t : active_project.tracks) {
+    if (t->view) t->view->remove(); // FIXME: dealloc view
+    set_track_view(t, NULL);
+  }
+  active_project.tracks.clear();
+  active_project.instruments.clear();
+
+  selected_track = NULL;
+  mark_dirty(UI_ALL);
+}
+
 Cell* lisp_clear_project(Cell* args, Cell* env) {
-  while (active_project.tracks.size()) {
-    selected_track = active_project.tracks[active_project.tracks.size()-1];
-    delete_selected_tracks(NULL, env);
+  project_clear();
+  journal_start(title_view ? title_view->getValue().c_str() : "untitled.l", 0);
+  return alloc_nil();
+}
+
+// loads the project at path, a binary snapshot or a lisp file, and replays
+// the edits its journal recorded after the last save, e.g. before a crash.
+// the journal is read before anything restarts it.
+void project_load(const char* path) {
+  int from_file = 1;
+  vector<std::string> entries;
+  int recover = journal_read(path, &from_file, &entries);
+
+  if (recover && !from_file) {
+    project_clear();
+  } else if (!project_load_binary(path)) {
+    project_clear();
+    eval_lisp_file((char*)path);
   }
+
+  if (!recover) {
+    journal_start(path, 1);
+    return;
+  }
+
+  printf("journal: recovering %d edits of %s\n",(int)entries.size(),path);
+  for (std::string& e : entries) {
+    eval(read_string((char*)e.c_str()), get_globals());
+  }
+  // the replayed edits were not journaled again, they stay in the journal
+  journal_resume(path, from_file, entries);
+}
+
+// (project-load path)
+Cell* lisp_project_load(Cell* args, Cell* env) {
+  if (!car(args) || car(args)->tag!=TAG_STR) return lisp_err("(project-load) invalid param #0 (path)");
+  project_load((char*)car(args)->addr);
   return alloc_nil();
 }
 
+// at startup: recovers the project if its journal has edits, else starts an
+// empty one
+void journal_recover(const char* path) {
+  int from_file;
+  vector<std::string> entries;
+  if (journal_read(path, &from_file, &entries)) {
+    project_load(path);
+  } else {
+    journal_start(path, 0);
+  }
+}
+
 void init_lisp_funcs() {
   init_lisp();
   
   register_alien_func("instrument",add_instrument);
   register_alien_func("track",add_track);
+  register_alien_func("track-insert",lisp_track_insert);
   register_alien_func("region",add_region);
+  register_alien_func("region-delete",lisp_region_delete);
+  register_alien_func("track-remove",lisp_track_remove);
+  register_alien_func("bpm",lisp_bpm);
+  register_alien_func("automation",lisp_automation);
+  register_alien_func("automation-point",lisp_automation_point);
+  register_alien_func("automation-clear",lisp_automation_clear);
+  register_alien_func("automation-thinning",lisp_automation_thinning);
   
   register_alien_func("project-path",lisp_project_path);
   register_alien_func("all-instruments",lisp_all_instruments);
   register_alien_func("all-tracks",lisp_all_tracks);
   register_alien_func("all-regions",lisp_all_regions);
+  register_alien_func("all-automation",lisp_all_automation);
 
   register_alien_func("add-region-at-mouse",lisp_add_region_at_mouse);
   register_alien_func("edit-region-external",external_edit_selected_region);
@@ -1563,36 +3973,133 @@ void init_lisp_funcs() {
   register_alien_func("set-regions-length",set_regions_length);
 
   register_alien_func("delete-selected-tracks",delete_selected_tracks);
+
+  register_alien_func("undo",lisp_undo);
+  register_alien_func("redo",lisp_redo);
+  register_alien_func("undo-budget",lisp_undo_budget);
   
   register_alien_func("bounce-loop",bounce_loop);
   register_alien_func("interactive-eval",lisp_eval_dialog);
   
   register_alien_func("project-save",lisp_save_project);
+  register_alien_func("project-save-binary",lisp_save_project_binary);
+  register_alien_func("project-load",lisp_project_load);
+  register_alien_func("project-load-binary",lisp_load_project_binary);
+  register_alien_func("midi-import",lisp_midi_import);
+  register_alien_func("midi-export",lisp_midi_export);
   register_alien_func("project-clear",lisp_clear_project);
+  register_alien_func("eval-file",lisp_eval_file);
+  register_alien_func("journal-open",lisp_journal_open);
+  register_alien_func("journal-compact",lisp_journal_compact);
   
+  register_alien_func("ui-stats",lisp_ui_stats);
+  register_alien_func("ui-stats-reset",lisp_ui_stats_reset);
+  register_alien_func("toggle-ui-stats",lisp_toggle_ui_stats);
+
   register_alien_func("print",lisp_dump);
 }
 
-#define LOAD_BUFFER_SIZE 1024*1024
+#define LOAD_CHUNK_SIZE 64*1024
+#define LOAD_MAX_DEPTH 100
+
+// forms calling C functions don't keep references into themselves, so their
+// cells can go once they ran (strings stay, free_tree() keeps their text)
+static bool alien_form(Cell* form, Cell* env) {
+  Cell* op = car(form);
+  if (op && op->tag==TAG_SYM) op = lookup_symbol(op, env);
+  return op && op->tag==TAG_BUILTIN && op->value==BUILTIN_ALIEN;
+}
+
+static Cell* eval_loaded(Cell* form, Cell* env, Cell* result) {
+  Cell* r = eval(form, env);
+  free_tree(result);
+  result = alloc_clone(r, 0);
+  if (alien_form(form, env)) free_tree(form);
+  return result;
+}
+
+// reads filename in chunks and evaluates every top-level form when its closing
+// paren arrives. project files are a single (let (bindings) form ...), so the
+// forms in the body of a top-level let are evaluated one by one as well, in an
+// environment with the bindings, and unlinked from the let afterwards: memory
+// stays at the size of one form instead of the whole file.
 Cell* eval_lisp_file(char* filename) {
-  Cell* evaled = alloc_nil();
-  
-  char* buffer = (char*)malloc(LOAD_BUFFER_SIZE);
-  memset(buffer,0,LOAD_BUFFER_SIZE);
-  
-  FILE* f;
-  if ((f = fopen(filename,"r"))) {
-    int l = fread(buffer, 1, LOAD_BUFFER_SIZE, f);
-    fclose(f);
+  FILE* f = fopen(filename,"r");
+  if (!f) return alloc_nil();
+  posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL); // read ahead while we evaluate
+
+  static char chunk[LOAD_CHUNK_SIZE];
+  Cell** stack_root = (Cell**)malloc(LOAD_MAX_DEPTH*sizeof(Cell*));
+  ReaderState rs;
+  rs.state = PST_ATOM;
+  rs.cell = 0;
+  rs.level = 0;
+  rs.stack = stack_root;
+
+  Cell* result = alloc_nil();
+  Cell* env = NULL;      // of the top-level let whose body is streamed
+  Cell* bindings = NULL; // cons of the let holding the bindings
+  long pos = 0;
+  int forms = 0;
+  int l;
+
+  while ((l = fread(chunk, 1, LOAD_CHUNK_SIZE, f))>0) {
+    for (int i=0; i<l; i++, pos++) {
+      uint level = rs.level;
+      if (level>=LOAD_MAX_DEPTH-1 && rs.state==PST_ATOM && chunk[i]=='(') {
+        printf("%s: nested too deeply at %ld\n",filename,pos);
+        goto done;
+      }
+      read_char(chunk[i], &rs);
+      if (rs.state>=10) {
+        printf("%s: read error %d at %ld\n",filename,rs.state,pos);
+        goto done;
+      }
+
+      if (level==2 && rs.level==1) {
+        // an element of the top-level list is complete
+        Cell* list = (Cell*)stack_root[0]->addr;
+        Cell* elem = stack_root[1];
+        Cell* head = car(list);
+
+        if (elem==list->next && head->tag==TAG_SYM && !strcmp((char*)head->addr, "let")) {
+          bindings = elem;
+          env = get_globals();
+          for (Cell* b=car(elem); b && !is_nil(b) && cdr(b); b=cdr(cdr(b))) {
+            env = alloc_cons(alloc_cons(car(b), alloc_clone(eval(car(cdr(b)), env), 0)), env);
+          }
+        } else if (bindings) {
+          result = eval_loaded(car(elem), env, result);
+          bindings->next = rs.cell;
+          free(elem);
+          forms++;
+        }
+      } else if (level==1 && rs.level==0) {
+        Cell* root = stack_root[0];
+        Cell* form = car(root);
+        if (bindings) {
+          // only atoms can be left in the body
+          for (Cell* b=cdr(bindings); b && !is_nil(b); b=cdr(b)) result = eval_loaded(car(b), env, result);
+        } else {
+          result = eval_loaded(form, get_globals(), result);
+        }
+        forms++;
+        bindings = NULL;
 
-    if (l) {
-      Cell* expr = read_string(buffer);
-      evaled = alloc_clone(eval(expr, get_globals()), 0);
+        if (root->next) free(root->next);
+        free(root);
+        rs.cell = 0;
+        rs.stack = stack_root;
+      }
     }
   }
+  if (rs.level) printf("%s: missing %d closing parens\n",filename,rs.level);
+  printf("%s: evaluated %d forms, %ld bytes\n",filename,forms,pos);
 
-  free(buffer);
-  return evaled;
+done:
+  fclose(f);
+  free(stack_root);
+  return result;
 }
 
 Cell* load_init_file() {
@@ -1603,15 +4110,31 @@ Cell* load_project_file() {
   return eval_lisp_file("project.l");
 }
 
-void ui_update_task() {
-  struct timespec tim, tim2;
-  tim.tv_sec = 0;
-  tim.tv_nsec = 25*1000000L;
+// x11_wake() arrived on the GUI thread
+void wake_callback() {
+  if (main_window) main_window->requestDraw();
+}
+
+// root draw callback: runs on the GL thread right before the views are drawn
+void on_frame(View* v, GLV& glv) {
+  int new_frame = uistats_frame(glv);
 
-  while (running) {
-    update_ui();
-    nanosleep(&tim, &tim2);
+  double t = uistats_now_ms();
+  if (peaks_arrived.exchange(false, std::memory_order_acquire)) {
+    for (Track* tr : active_project.tracks) {
+      TrackLane* lane = (TrackLane*)tr->view;
+      if (lane && lane->waves_pending) lane->redo_waves();
+    }
+  }
+  update_ui();
+  schedule_update();
+  if (new_frame) {
+    uistats_update_ui(uistats_now_ms()-t);
+    if (stats_overlay && stats_overlay->visible()) stats_overlay->sync();
   }
+  
+  // keep frames coming while the playhead moves
+  if (playback_enabled) glv.refresh();
 }
 
 int main(int argc, char **argv) {
@@ -1637,6 +4160,10 @@ int main(int argc, char **argv) {
 
   update_ui();
 
+  // edits journaled since the last save survive a crash
+  journal_recover(title_view->getValue().c_str());
+  atexit(journal_stop);
+
   glv_root.on(Event::MouseMove, on_root_mousemove);
   glv_root.on(Event::MouseDrag, on_root_mousemove);
   glv_root.on(Event::MouseDown, on_root_mousedown);
@@ -1645,12 +4172,12 @@ int main(int argc, char **argv) {
   glv_root.on(Event::KeyRepeat, on_root_keydown);
   //glv_root.enable(Controllable | HitTest);
   
-  glv::Window win(win_w, win_h, "mnt produce 0.1.0", &glv_root);
+  // frames are only drawn on demand, 60 fps is the pace during playback
+  glv::Window win(win_w, win_h, "mnt produce 0.1.0", &glv_root, 60.0);
+  main_window = &win;
   
   x11_stuff_init();
 
-  std::thread t1(ui_update_task);
-  
   playback_enabled = 0;
 
   Application::run();
@@ -337,6 +337,55 @@ public:
 
 
 
+/// Spatial index over the children of a View
+
+/// Children are bucketed into a uniform grid of cells so that hit testing
+/// only has to look at the children overlapping one cell instead of the whole
+/// sibling chain. Children spanning too many cells are kept in a separate
+/// list that is always searched. The index is kept up to date by View's
+/// tree and geometry setters; direct writes to l, t, w or h are only picked
+/// up on the next rectifyGeometry().
+class ChildIndex{
+public:
+
+	/// @param[in] cellW	Width of grid cells
+	/// @param[in] cellH	Height of grid cells
+	ChildIndex(space_t cellW, space_t cellH);
+
+	void insert(View& v);		///< Add a child as the last sibling
+	void remove(View& v);		///< Remove a child
+	void update(View& v);		///< Re-bucket a child if its rect has changed
+	void clear();				///< Remove all children
+
+	/// Returns the last visible child in sibling order containing (x,y) or 0 if none
+	View * find(space_t x, space_t y) const;
+
+	/// Returns whether the rect of a child matches the one it is indexed under
+	bool current(const View& v) const;
+
+	unsigned size() const { return mEntries.size(); }	///< Number of indexed children
+
+private:
+	struct Entry{
+		Rect rect;			// rect the child was bucketed with
+		unsigned order;		// position in sibling chain, larger is later
+		bool oversized;		// in mOversized instead of the grid
+	};
+	typedef std::pair<int,int> Cell;
+	typedef std::map<Cell, std::vector<View *> > Grid;
+
+	std::map<const View *, Entry> mEntries;
+	Grid mGrid;
+	std::vector<View *> mOversized;
+	space_t mCellW, mCellH;
+	unsigned mOrder;
+
+	void cellRange(const Rect& r, int& x0, int& y0, int& x1, int& y1) const;
+	void bucket(View& v, Entry& e, bool add);
+};
+
+
+
 /// The base class of all GUI elements.
 class View : public Rect, public DataModel, public Notifier, public SmartObject<View> {
 
@@ -480,6 +529,15 @@ public:
 
 	void rectifyGeometry();						///< Correct geometry for proper display 
 
+	/// Index children in a grid of cells for faster hit testing
+
+	/// Useful for containers with many children, e.g. rows of a table. A cell
+	/// size of 0 removes the index.
+	View& indexChildren(space_t cellW, space_t cellH);
+	
+	/// Returns the child index or 0 if children are not indexed
+	const ChildIndex * childIndex() const { return mChildIndex; }
+
 protected:
 	Property::t mFlags;				// Property flags
 	Style * mStyle;					// Visual appearance
@@ -489,10 +547,12 @@ protected:
 	std::string mName;				// Settable name identifier
 	std::string mDescriptor;		// String describing view
 	Font * mFont;					// constructed on first use
+	ChildIndex * mChildIndex;		// optional spatial index of children
 
 	void doDraw(GLV& g);
 	bool hasName() const { return ""!=mName; }
 	void reanchor(space_t dx, space_t dy);	// Reanchor when parent resizes
+	virtual void onMove(space_t dx, space_t dy);	// Keeps parent's child index up to date
 };
 
 
@@ -527,6 +587,30 @@ public:
 	/// Get reference to temporary graphics data for rendering
 	GraphicsData& graphicsData(){ return mGraphicsData; }
 
+	/// Request a redraw on the next frame
+
+	/// The window binding only redraws when a redraw was requested since the
+	/// last frame. Input events request one automatically.
+	void refresh(){ mRefresh = true; }
+
+	/// Whether a redraw has been requested since the last frame
+	bool refreshRequested() const { return mRefresh; }
+
+	/// Number of views the last frame traversed
+	unsigned viewsVisited() const { return mViewsVisited; }
+
+	/// Number of views the last frame actually drew; the rest were culled
+	unsigned viewsDrawn() const { return mViewsDrawn; }
+
+	/// Number of draw calls issued during the last frame
+	unsigned drawCalls() const { return mDrawCalls; }
+
+	/// Number of frames drawn so far
+	unsigned frames() const { return mFrames; }
+
+	/// Time in seconds it took to issue the last frame, not including buffer swap
+	double drawTime() const { return mDrawTime; }
+
 
 	/// Sends an event to everyone in tree (including self)
 	void broadcastEvent(Event::t e);
@@ -612,6 +696,10 @@ protected:
 	Event::t mEventType;	// current event type
 	ModelManager mMM;
 	GraphicsData mGraphicsData;
+	volatile bool mRefresh;	// redraw requested
+	std::vector<Rect> mCropRects;	// per level crop rects, reused by drawWidgets()
+	unsigned mViewsVisited, mViewsDrawn, mDrawCalls, mFrames;
+	double mDrawTime;
 
 	// Returns whether the event should be bubbled to parent
 	bool doEventCallbacks(View& target, Event::t e);
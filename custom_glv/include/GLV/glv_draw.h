@@ -39,11 +39,41 @@ struct Point3{
 };
 
 
+class GraphicsData;
+namespace draw{ void paint(int prim, const GraphicsData& gb); }
+
 /// Buffers of vertices, colors, and indices
+
+/// In retained mode the buffers are uploaded to vertex buffer objects the
+/// first time they are painted and re-used on later frames until the data
+/// is marked dirty. Calling reset() marks the data dirty.
 class GraphicsData{
 public:
 
-	GraphicsData(): mColors(1){}
+	GraphicsData(): mColors(1), mRetained(false), mDirty(true){
+		mBufferObjects[0] = mBufferObjects[1] = mBufferObjects[2] = 0;
+	}
+
+	/// Copies the data, buffer objects are not shared
+	GraphicsData(const GraphicsData& v)
+	:	mVertices2(v.mVertices2), mVertices3(v.mVertices3),
+		mColors(v.mColors), mIndices(v.mIndices),
+		mRetained(v.mRetained), mDirty(true)
+	{
+		mBufferObjects[0] = mBufferObjects[1] = mBufferObjects[2] = 0;
+	}
+
+	~GraphicsData();
+
+	/// Copies the data, keeps own buffer objects
+	GraphicsData& operator= (const GraphicsData& v){
+		if(this != &v){
+			mVertices2 = v.mVertices2; mVertices3 = v.mVertices3;
+			mColors = v.mColors; mIndices = v.mIndices;
+			mRetained = v.mRetained; mDirty = true;
+		}
+		return *this;
+	}
 
 	/// Get color buffer
 	const Buffer<Color>& colors() const { return mColors; }
@@ -57,12 +87,25 @@ public:
 	/// Get 3D vertex buffer
 	const Buffer<Point3>& vertices3() const { return mVertices3; }
 
+	/// Whether data is kept in buffer objects between frames
+	bool retained() const { return mRetained; }
+
+	/// Whether data has changed since it was last uploaded
+	bool dirty() const { return mDirty; }
+
 	/// Reset all buffers
 	void reset(){
 		mVertices2.reset(); mVertices3.reset();
 		mColors.reset(); mIndices.reset();
+		mDirty = true;
 	}
 
+	/// Set retained mode
+	void retain(bool v){ mRetained = v; mDirty = true; }
+
+	/// Mark data as changed so that it is uploaded again on the next paint
+	void markDirty(){ mDirty = true; }
+
 	/// Append color
 	void addColor(const Color& c){
 		colors().append(c); }
@@ -141,10 +184,18 @@ public:
 	Buffer<Point3>& vertices3(){ return mVertices3; }
 
 protected:
+	friend void draw::paint(int prim, const GraphicsData& gb);
+
 	Buffer<Point2> mVertices2;
 	Buffer<Point3> mVertices3;
 	Buffer<Color> mColors;
 	Buffer<unsigned> mIndices;
+
+	bool mRetained;
+	mutable bool mDirty;
+	mutable GLuint mBufferObjects[3];	// vertices, colors, indices
+	mutable int mNumRetained[3];		// sizes at last upload
+	mutable int mRetainedDim;			// 2 or 3 dimensional vertices
 };
 
 
@@ -224,6 +275,7 @@ void lineStipple(char factor, short pattern);		///< Specify line stipple pattern
 void lineWidth(float val);							///< Set width of lines
 void matrixMode(int mode);							///< Set current transform matrix
 void ortho(float l, float r, float b, float t);		///< Set orthographic projection mode
+extern unsigned drawCallCount;						///< Number of draw calls issued by paint() so far
 void paint(int prim, Point2 * verts, int numVerts);	///< Draw array of 2D vertices
 void paint(int prim, const GraphicsData& gb);		///< Render graphics data
 void paint(int prim, Point2 * verts, Color * cols, int numVerts);
@@ -391,6 +443,7 @@ void spokes(float l, float t, float r, float b){
 inline void paint(int prim, Point2 * verts, int numVerts){
 	//glEnableClientState(GL_VERTEX_ARRAY);
 	glVertexPointer(2, GL_FLOAT, 0, verts);
+	++drawCallCount;
 	glDrawArrays(prim, 0, numVerts);
 	//glDisableClientState(GL_VERTEX_ARRAY);
 }
@@ -399,12 +452,14 @@ inline void paint(int prim, Point2 * verts, Color * cols, int numVerts){
 	glEnableClientState(GL_COLOR_ARRAY);
 	glVertexPointer(2, GL_FLOAT, 0, verts);
 	glColorPointer(4, GL_FLOAT, 0, cols);
+	++drawCallCount;
 	glDrawArrays(prim, 0, numVerts);
 	glDisableClientState(GL_COLOR_ARRAY);
 }
 
 inline void paint(int prim, Point2 * verts, unsigned * indices, int numIndices){
 	glVertexPointer(2, GL_FLOAT, 0, verts);
+	++drawCallCount;
 	glDrawElements(prim, numIndices, GL_UNSIGNED_INT, indices);
 }
 
@@ -412,12 +467,14 @@ inline void paint(int prim, Point2 * verts, Color * cols, unsigned * indices, in
 	glEnableClientState(GL_COLOR_ARRAY);
 	glVertexPointer(2, GL_FLOAT, 0, verts);
 	glColorPointer(4, GL_FLOAT, 0, cols);
+	++drawCallCount;
 	glDrawElements(prim, numIndices, GL_UNSIGNED_INT, indices);
 	glDisableClientState(GL_COLOR_ARRAY);
 }
 
 inline void paint(int prim, Point3 * verts, int numVerts){
 	glVertexPointer(3, GL_FLOAT, 0, verts);
+	++drawCallCount;
 	glDrawArrays(prim, 0, numVerts);
 }
 
@@ -425,12 +482,14 @@ inline void paint(int prim, Point3 * verts, Color * cols, int numVerts){
 	glEnableClientState(GL_COLOR_ARRAY);
 	glVertexPointer(3, GL_FLOAT, 0, verts);
 	glColorPointer(4, GL_FLOAT, 0, cols);
+	++drawCallCount;
 	glDrawArrays(prim, 0, numVerts);
 	glDisableClientState(GL_COLOR_ARRAY);
 }
 
 inline void paint(int prim, Point3 * verts, unsigned * indices, int numIndices){
 	glVertexPointer(3, GL_FLOAT, 0, verts);
+	++drawCallCount;
 	glDrawElements(prim, numIndices, GL_UNSIGNED_INT, indices);
 }
 
@@ -438,6 +497,7 @@ inline void paint(int prim, Point3 * verts, Color * cols, unsigned * indices, in
 	glEnableClientState(GL_COLOR_ARRAY);
 	glVertexPointer(3, GL_FLOAT, 0, verts);
 	glColorPointer(4, GL_FLOAT, 0, cols);
+	++drawCallCount;
 	glDrawElements(prim, numIndices, GL_UNSIGNED_INT, indices);
 	glDisableClientState(GL_COLOR_ARRAY);
 }
@@ -120,12 +120,18 @@ public:
 	/// Called when the width or height change.  Changes in extent are passed in.
 	virtual void onResize(T dx, T dy){}
 	
+	/// Called when the left or top edge position changes.  Changes in position are passed in.
+	virtual void onMove(T dx, T dy){}
+	
 	void print(FILE * fp=stdout);	///< write about TRect to a file
 	
 private:
 	void onResizeProxy(T dx, T dy){	// calls onResize if at least 1 dimension has changed
 		if(dx!=T(0) || dy!=T(0)) onResize(dx,dy);
 	}
+	void onMoveProxy(T dx, T dy){	// calls onMove if at least 1 coordinate has changed
+		if(dx!=T(0) || dy!=T(0)) onMove(dx,dy);
+	}
 };
 
 
@@ -162,35 +168,34 @@ TEM inline void TRect<T>::extent(T wi, T he){
 TEM inline void TRect<T>::fitSquare(T v){ w > h ? extent(v, v * h/w) : extent(v * w/h, v); }
 
 TEM inline void TRect<T>::fixNegativeExtent(){
-	if(w < (T)0){ w = -w; l -= w; }
-	if(h < (T)0){ h = -h; t -= h; }
+	if(w < (T)0){ w = -w; l -= w; onMoveProxy(-w, 0); }
+	if(h < (T)0){ h = -h; t -= h; onMoveProxy(0, -h); }
 }
 
-TEM inline void TRect<T>::pos(T le, T to){ l = le; t = to; }
-TEM inline void TRect<T>::posAdd(T x, T y){ l += x; t += y; }
+TEM inline void TRect<T>::pos(T le, T to){ T dx=le-l, dy=to-t; l = le; t = to; onMoveProxy(dx, dy); }
+TEM inline void TRect<T>::posAdd(T x, T y){ l += x; t += y; onMoveProxy(x, y); }
 TEM inline void TRect<T>::posRightOf(const TRect<T> & r, T by){ pos(r.right() + by, r.t); }
 
 TEM inline void TRect<T>::posRelTo(const TRect<T>& r, float rxf, float ryf, float xf, float yf, float x, float y){
-	l = r.l + r.w*rxf - w*xf + x;
-	t = r.t + r.h*ryf - h*yf + y;
+	pos(r.l + r.w*rxf - w*xf + x, r.t + r.h*ryf - h*yf + y);
 }
 
 TEM inline void TRect<T>::posUnder(const TRect<T> & r, T by){ pos(r.l, r.bottom() + by); }
-TEM inline void TRect<T>::resizeLeftTo(T v){ T dl = l-v; w += dl; l = v; onResizeProxy(dl, 0); }
-TEM inline void TRect<T>::resizeTopTo(T v){	T dt = t-v; h += dt; t = v; onResizeProxy(0, dt); }
+TEM inline void TRect<T>::resizeLeftTo(T v){ T dl = l-v; w += dl; l = v; onMoveProxy(-dl, 0); onResizeProxy(dl, 0); }
+TEM inline void TRect<T>::resizeTopTo(T v){	T dt = t-v; h += dt; t = v; onMoveProxy(0, -dt); onResizeProxy(0, dt); }
 TEM inline void TRect<T>::resizeRightTo(T v){ width(v - l); }
 TEM inline void TRect<T>::resizeBottomTo(T v){ height(v - t); }
-TEM inline void TRect<T>::resizeEdgesBy(T v){ l -= v; t -= v; extent(w + 2 * v, h + 2 * v); }
+TEM inline void TRect<T>::resizeEdgesBy(T v){ posAdd(-v, -v); extent(w + 2 * v, h + 2 * v); }
 TEM inline void TRect<T>::set(const TRect<T>& r){ set(r.l, r.t, r.w, r.h); }
 TEM inline void	TRect<T>::set(T le, T to, T wi, T he){ pos(le, to); extent(wi, he); }
 TEM inline void TRect<T>::transpose(){ extent(h, w); }
 
-TEM inline void TRect<T>::left  (T v){ l = v; }
-TEM inline void TRect<T>::top   (T v){ t = v; }
+TEM inline void TRect<T>::left  (T v){ pos(v, t); }
+TEM inline void TRect<T>::top   (T v){ pos(l, v); }
 TEM inline void TRect<T>::width (T v){ extent(v, h); }
 TEM inline void TRect<T>::height(T v){ extent(w, v); }
-TEM inline void TRect<T>::bottom(T v){ t = v - h; }
-TEM inline void TRect<T>::right (T v){ l = v - w; }
+TEM inline void TRect<T>::bottom(T v){ pos(l, v - h); }
+TEM inline void TRect<T>::right (T v){ pos(v - w, t); }
 
 TEM inline const TRect<T>& TRect<T>::rect() const { return *this; }
 TEM inline T TRect<T>::right() const { return l + w; }
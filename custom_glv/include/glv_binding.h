@@ -78,6 +78,7 @@ public:
 	void iconify();										///< Iconifies window
 	void maximize(bool on);								///< Maximizes window on screen
 	void position(unsigned left, unsigned top);			///< Sets position from left-top corner of screen
+	void requestDraw();									///< Draws a new frame soon if the GLV requested one. Call from the event loop thread.
 	void resize(unsigned w, unsigned h);				///< Resize swindow
 	void setGLV(GLV& g);								///< Sets top GLV View
 	void setGLVDims(unsigned w, unsigned h);
@@ -111,6 +112,7 @@ protected:
 	void implHideCursor(bool hide);
 	void implInitialize();						// initialize windowing impl
 	void implPosition(unsigned l, unsigned t);
+	void implRequestDraw();
 	void implResize(unsigned w, unsigned h);
 	void implHide();
 	void implShow();
@@ -4,6 +4,11 @@
 /*	Graphics Library of Views (GLV) - GUI Building Toolkit
 	See COPYRIGHT file for authors and license information */
 
+#include <map>
+#include <string>
+#include <vector>
+#include "glv_color.h"
+
 namespace glv{
 
 /// Font
@@ -23,8 +28,40 @@ public:
 	virtual void getBounds(float& w, float& h, const char * text) const;
 
 	/// Render text string
+	
+	/// The line geometry of each string is cached, so rendering the same
+	/// text again with the same size and line width only costs a draw call.
 	virtual void render(const char * text, float x=0, float=0, float z=0);
 
+	/// Render text string in color c, batched if batching
+	
+	/// Places the text with the offset set by batchContext() instead of the
+	/// current transform, so use it only where the view's drawing context
+	/// is untransformed. Text lying completely inside the context's crop rect
+	/// is appended to a shared line list, partially cropped text is drawn
+	/// right away.
+	void renderBatched(const char * text, float x, float y, const Color& c);
+
+	/// Start collecting text of all fonts rendered with renderBatched()
+	static void beginBatch();
+
+	/// Set the window offset and crop rect of the view drawn next
+	static void batchContext(float x, float y, float l, float t, float r, float b);
+
+	/// Draw all batched text with one call per line width and clear the batch
+	
+	/// Expects a 2D pixel projection, as set up by draw::push2D.
+	static void endBatch();
+
+	/// Whether batched text lies within a pixel of the window rect [l,t,w,h]
+	
+	/// Whatever is drawn there next must flushBatch() first to stay on top
+	/// of the text drawn before it.
+	static bool batchOverlaps(float l, float t, float w, float h);
+
+	/// Draw the batched text now and keep batching
+	static void flushBatch();
+
 
 	/// Set spacing, in ems, between the left and right edges of successive letters
 	Font& letterSpacing(float v);
@@ -32,6 +69,9 @@ public:
 	/// Set spacing, in ems, between lines
 	Font& lineSpacing(float v);
 
+	/// Set width of glyph strokes, in pixels
+	Font& lineWidth(float v);
+
 	/// Set the font size in pixels
 	Font& size(unsigned size);
 	
@@ -48,6 +88,9 @@ public:
 	
 	/// Get line spacing, in ems
 	float lineSpacing() const { return mLineSpacing; }
+
+	/// Get width of glyph strokes, in pixels
+	float lineWidth() const { return mLineWidth; }
 	
 	/// Get scaling factor in x direction
 	float scaleX() const { return mScaleX; }
@@ -59,11 +102,31 @@ public:
 	unsigned tabSpaces() const { return mTabSpaces; }
 
 private:
+	struct CacheKey{
+		CacheKey(const char * t, unsigned s, float lw): text(t), size(s), lineWidth(lw){}
+		bool operator< (const CacheKey& k) const {
+			if(size != k.size) return size < k.size;
+			if(lineWidth != k.lineWidth) return lineWidth < k.lineWidth;
+			return text < k.text;
+		}
+		std::string text;
+		unsigned size;
+		float lineWidth;
+	};
+	
+	// line list vertices (x,y pairs) in pixels, relative to the text origin
+	typedef std::vector<float> Geometry;
+	typedef std::map<CacheKey, Geometry> GeometryCache;
+
 	unsigned mSize;
 	float mScaleX, mScaleY;
 	float mLetterSpacing;
 	float mLineSpacing;
+	float mLineWidth;
 	unsigned mTabSpaces;
+	GeometryCache mCache;
+	
+	const Geometry& geometry(const char * text);
 };
 
 
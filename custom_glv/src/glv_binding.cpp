@@ -200,6 +200,8 @@ void Window::setGLV(GLV& g){
 
 bool Window::shouldDraw(){ return glv() && active() /*&& visible()*/; }
 
+void Window::requestDraw(){ implRequestDraw(); }
+
 void Window::show(){ implShow(); }
 
 void Window::title(const std::string& v){ mTitle=v; implTitle(); }
@@ -25,7 +25,8 @@ public:
 	Impl(Window *window, int winID)
 	: mWindow(window)
 	, mID(winID)
-	, mInGameMode(false){
+	, mInGameMode(false)
+	, mTimerArmed(false){
 		windows()[mID] = this;
 	}
 	
@@ -43,8 +44,42 @@ public:
 		}
 	}
 	
+	// Drawing is demand driven. A redisplay is posted when the GLV requests a
+	// refresh, e.g. after input. If it requests another one while drawing, as
+	// animations do, the next frame is paced by a timer at fps(). Otherwise
+	// no timer is running and GLUT sleeps until the next window system event.
 	void scheduleDraw(){
-		scheduleDrawStatic(mInGameMode ? mIDGameMode : mID);
+		GLV * g = mWindow->mGLV;
+		if(g && g->refreshRequested()){
+			int current = glutGetWindow();
+			int id = winID();
+			if(id != current) glutSetWindow(id);
+			glutPostRedisplay();
+			if(current && id != current) glutSetWindow(current);
+		}
+	}
+	
+	// Called by GLUT to redraw the window, either posted by us or because
+	// window contents were exposed
+	void display(){
+		GLV * g = mWindow->mGLV;
+		if(g) g->refresh();
+		draw();
+		
+		if(g && g->refreshRequested() && !mTimerArmed){
+			double ms = 1000.0/mWindow->fps() - g->drawTime()*1000.0;
+			mTimerArmed = true;
+			glutTimerFunc(ms > 0 ? (unsigned int)ms : 0, frameTimerStatic, winID());
+		}
+	}
+	
+	// Input changes what is shown, so the current window gets a new frame
+	static void refreshCurrent(){
+		Impl * w = getWindowImpl();
+		if(w && w->mWindow->mGLV){
+			w->mWindow->mGLV->refresh();
+			w->scheduleDraw();
+		}
 	}
 	
 	void showing(bool v){ mShowing=v; }
@@ -78,17 +113,14 @@ private:
 
 	typedef std::map<int, Impl *> WindowsMap;
 
-	// schedule draws of a specific window
-	static void scheduleDrawStatic(int winID){
+	int winID() const { return mInGameMode ? mIDGameMode : mID; }
+
+	// next animation frame of a specific window is due
+	static void frameTimerStatic(int winID){
 		Impl *impl = getWindowImpl(winID);
-		
-		// If there is a valid implementation, then draw and schedule next draw...
 		if(impl){
-			int current = glutGetWindow();
-			if(winID != current) glutSetWindow(winID);
-			impl->draw();
-			glutTimerFunc((unsigned int)(1000.0/getWindow()->fps()), scheduleDrawStatic, winID);
-			if(current) glutSetWindow(current);
+			impl->mTimerArmed = false;
+			impl->scheduleDraw();
 		}
 	}
 
@@ -104,6 +136,7 @@ private:
 	int mIDGameMode;
 	bool mInGameMode;
 	bool mShowing;
+	bool mTimerArmed;	// an animation frame is scheduled
     
 	friend class Window;
 };
@@ -121,7 +154,8 @@ void Application::implRun(){
 
 
 static void glutDisplayCB(){
-	// this is empty because we are using a periodic timer for drawing
+	Window::Impl * w = Window::Impl::getWindowImpl();
+	if(w) w->display();
 }
 
 // this must be called whenever a GLUT input event for a keyboard or mouse
@@ -215,6 +249,7 @@ static void keyToGLV(unsigned int key, bool down, bool special){
 		down ? g->setKeyDown(key) : g->setKeyUp(key);
 		modToGLV();
 		g->propagateEvent();
+		Window::Impl::refreshCurrent();
 	}
 }
 
@@ -254,6 +289,7 @@ static void glutMouseCB(int btn, int state, int ax, int ay){
 		g->setMousePos((int)x, (int)y, relx, rely);
 		modToGLV();
 		g->propagateEvent();
+		Window::Impl::refreshCurrent();
 	}
 }
 
@@ -269,6 +305,7 @@ static void motionToGLV(int ax, int ay, glv::Event::t e){
 		g->setMousePos((int)x, (int)y, relx, rely);
 		//modToGLV();	// GLUT complains about calling glutGetModifiers()
 		g->propagateEvent();
+		Window::Impl::refreshCurrent();
 	}
 }
 
@@ -289,6 +326,7 @@ static void glutReshapeCB(int w, int h){
 	Window * win = Window::Impl::getWindow();
 	//if(win) win->resize(w, h);
 	if(win) win->setGLVDims(w, h);
+	Window::Impl::refreshCurrent();
 }
 
 static void registerCBs(){
@@ -443,6 +481,8 @@ void Window::implResize(unsigned w, unsigned h){
 	glutReshapeWindow((int)w, (int)h); // this will call the reshape callback
 }
 
+void Window::implRequestDraw(){ if(mImpl) mImpl->scheduleDraw(); }
+
 void Window::implShow(){ glutShowWindow(); }
 
 bool Window::implShowing() const {
@@ -8,6 +8,8 @@
 namespace glv{
 namespace draw{
 
+unsigned drawCallCount = 0;
+
 int printError(const char * pre, bool verbose, FILE * out){
 	GLenum err = glGetError();
 	#define CS(v, desc) case GL_##v: printf("%s%s%s\n", pre, #v, verbose?": "desc :""); break;	
@@ -123,7 +125,79 @@ void grid(GraphicsData& g, float l, float t, float w, float h, float divx, float
 //}
 
 
+static bool bufferObjectsSupported(){
+	#ifdef GLEW_VERSION_1_5
+	return GLEW_VERSION_1_5;
+	#else
+	return true;
+	#endif
+}
+
+// upload retained data if it changed and draw from the buffer objects
+static void paintRetained(int prim, const GraphicsData& b,
+	GLuint * bo, int * num, int& dim, bool& dirty
+){
+	if(!bo[0]) glGenBuffers(3, bo);
+
+	if(dirty){
+		int Nc = b.colors().size();
+		int Nv2= b.vertices2().size();
+		int Nv3= b.vertices3().size();
+		int Ni = b.indices().size();
+
+		dim = Nv3 ? 3 : 2;
+		num[0] = Nv3 ? Nv3 : Nv2;
+		num[1] = (Nc && (Nc >= Nv2 || Nc >= Nv3)) ? Nc : 0;
+		num[2] = Ni;
+
+		if(num[0]){
+			glBindBuffer(GL_ARRAY_BUFFER, bo[0]);
+			if(Nv3)	glBufferData(GL_ARRAY_BUFFER, Nv3*sizeof(Point3), &b.vertices3()[0], GL_STATIC_DRAW);
+			else	glBufferData(GL_ARRAY_BUFFER, Nv2*sizeof(Point2), &b.vertices2()[0], GL_STATIC_DRAW);
+		}
+		if(num[1]){
+			glBindBuffer(GL_ARRAY_BUFFER, bo[1]);
+			glBufferData(GL_ARRAY_BUFFER, Nc*sizeof(Color), &b.colors()[0], GL_STATIC_DRAW);
+		}
+		if(num[2]){
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bo[2]);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, Ni*sizeof(unsigned), &b.indices()[0], GL_STATIC_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		dirty = false;
+	}
+
+	if(!num[0]) return;
+
+	if(num[1]){
+		glEnableClientState(GL_COLOR_ARRAY);
+		glBindBuffer(GL_ARRAY_BUFFER, bo[1]);
+		glColorPointer(4, GL_FLOAT, 0, 0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, bo[0]);
+	glVertexPointer(dim, GL_FLOAT, 0, 0);
+
+	++drawCallCount;
+	if(num[2]){
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bo[2]);
+		glDrawElements(prim, num[2], GL_UNSIGNED_INT, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	else{
+		glDrawArrays(prim, 0, num[0]);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(num[1]) glDisableClientState(GL_COLOR_ARRAY);
+}
+
 void paint(int prim, const GraphicsData& b){
+	if(b.mRetained && bufferObjectsSupported()){
+		paintRetained(prim, b, b.mBufferObjects, b.mNumRetained, b.mRetainedDim, b.mDirty);
+		return;
+	}
+
 	int Nc = b.colors().size();
 	int Nv2= b.vertices2().size();
 	int Nv3= b.vertices3().size();
@@ -138,6 +212,7 @@ void paint(int prim, const GraphicsData& b){
 	if(Nv3)	glVertexPointer(3, GL_FLOAT, 0, &b.vertices3()[0]);
 	else	glVertexPointer(2, GL_FLOAT, 0, &b.vertices2()[0]);
 	
+	++drawCallCount;
 	if(Ni)	glDrawElements(prim, b.indices().size(), GL_UNSIGNED_INT, &b.indices()[0]);
 	else	glDrawArrays(prim, 0, Nv3 ? Nv3 : Nv2);
 
@@ -199,5 +274,11 @@ void text(const char * s, float l, float t, unsigned fontSize, float lineSpacing
 }
 
 } // draw::
+
+
+GraphicsData::~GraphicsData(){
+	if(mBufferObjects[0] && draw::bufferObjectsSupported()) glDeleteBuffers(3, mBufferObjects);
+}
+
 } // glv::
 
@@ -124,10 +124,11 @@ static Glyph glyphs[94] = {
 //	return int(v*rInv) * r + offset;
 //}
 
-static bool character(int c, float dx, float dy, float ps){
+// appends line list vertices of a character to xys, in glyph units
+static bool character(int c, float dx, float dy, std::vector<float>& xys){
 
 	// composite character
-	if(c == '$'){ character('S',dx,dy,ps); return character('|',dx,dy,ps); }
+	if(c == '$'){ character('S',dx,dy,xys); return character('|',dx,dy,xys); }
 
 	if(isgraph(c)){	// is graphical character?
 
@@ -136,7 +137,6 @@ static bool character(int c, float dx, float dy, float ps){
 //		float psInv = 1./ps;
 //		#define ALIGN(x) round(x,ps,psInv,po)
 		#define ALIGN(x) (x)
-		#define MUL(x) (x)/ps
 	
 		Point2 xy[32];
 		int ind=-1;
@@ -199,8 +199,10 @@ static bool character(int c, float dx, float dy, float ps){
 		//vertex(x[n] + dx, y[n] + dy);
 		
 		render:
-    glLineWidth(2);
-		draw::paint(draw::Lines, xy, ind+1);
+		for(int i=0; i<=ind; ++i){
+			xys.push_back(xy[i].x);
+			xys.push_back(xy[i].y);
+		}
 		return true;
 	}
 	
@@ -253,55 +255,171 @@ struct TextIterator{
 
 
 
+// text collected between Font::beginBatch() and Font::endBatch()
+namespace{
+	struct TextBatch{
+		float lineWidth;
+		GraphicsData data;	// window coordinates
+	};
+	bool sBatching = false;
+	std::vector<TextBatch *> sBatches;
+	float sBatchL = 1, sBatchT = 1, sBatchR = 0, sBatchB = 0;	// bounds of the batched text, empty if l > r
+	float sCtxX = 0, sCtxY = 0;							// window offset of the view drawn now
+	float sCtxL = 0, sCtxT = 0, sCtxR = 0, sCtxB = 0;	// and its crop rect
+
+	GraphicsData& batchFor(float lineWidth){
+		for(unsigned i=0; i<sBatches.size(); ++i){
+			if(sBatches[i]->lineWidth == lineWidth) return sBatches[i]->data;
+		}
+		TextBatch * b = new TextBatch;
+		b->lineWidth = lineWidth;
+		sBatches.push_back(b);
+		return b->data;
+	}
+}
+
+
 Font::Font(unsigned size_)
-:	mLetterSpacing(0), mLineSpacing(1), mTabSpaces(4)
+:	mLetterSpacing(0), mLineSpacing(1), mLineWidth(2), mTabSpaces(4)
 {
 	size(size_);
 }
 
 Font::~Font(){}
 
+const Font::Geometry& Font::geometry(const char * v){
+	CacheKey key(v, mSize, mLineWidth);
+	GeometryCache::iterator it = mCache.find(key);
+	if(it != mCache.end()) return it->second;
+
+	// editable text produces a new string on every change, keep it bounded
+	if(mCache.size() >= 32) mCache.clear();
+
+	struct BuildText : public TextIterator{
+		BuildText(const Font& f_, const char *& s_, Geometry& g_): TextIterator(f_,s_), g(g_){}
+		bool onPrintable(char c){
+			return character(c, x, y, g);
+		}
+		Geometry& g;
+	};
+
+	Geometry& g = mCache[key];
+	BuildText(*this, v, g).run();
+
+	for(unsigned i=0; i<g.size(); i+=2){
+		g[i  ] *= mScaleX;
+		g[i+1] *= mScaleY;
+	}
+	return g;
+}
+
 void Font::render(const char * v, float x, float y, float z){
 	using namespace glv::draw;
-	draw::push(ModelView);
-//	identity();
-//	translate(int(x), int(y), int(z));
-
-	float sx = mScaleX;
-	float sy = mScaleY;
-	float tx = x;
-	float ty = y;
-	float tz = z;
-	//float sh = -0.5*sy; // TODO: shear needs to be done an a per-line basis
-	float sh = 0;
 	
-	//tx=ty=tz=0;
+	const Geometry& g = geometry(v);
+	if(g.empty()) return;
 
-	float m[16] = {
-		sx, 0, 0, 0,
-		sh,sy, 0, 0,
-		 0, 0,sy, 0,
-		tx,ty,tz, 1
-	};
-	glMultMatrixf(m);
+	draw::push(ModelView);
+	draw::translate(x, y, z);
+	glLineWidth(mLineWidth);
+	draw::paint(draw::Lines, (Point2 *)&g[0], g.size()/2);
+	draw::pop(ModelView);
+}
 
-	struct RenderText : public TextIterator{
-		RenderText(const Font& f_, const char *& s_, float muly_): TextIterator(f_,s_), muly(muly_){}
-		bool onPrintable(char c){
-			return character(c, x, y, muly);
-		}
-		float muly;
-	} renderText(*this, v, 1./mScaleY);
+void Font::renderBatched(const char * v, float x, float y, const Color& c){
+	if(!sBatching){
+		draw::color(c);
+		render(v, x, y);
+		return;
+	}
 
-	renderText.run();
+	const Geometry& g = geometry(v);
+	if(g.empty()) return;
+
+	// window bounds from the context drawWidgets() set, no GL queries
+	unsigned n = g.size();
+	float ox = x + sCtxX, oy = y + sCtxY;
+	float l=1e9, t=1e9, r=-1e9, b=-1e9;
+	for(unsigned i=0; i<n; i+=2){
+		float wx = g[i]+ox, wy = g[i+1]+oy;
+		if(wx < l) l = wx;
+		if(wx > r) r = wx;
+		if(wy < t) t = wy;
+		if(wy > b) b = wy;
+	}
+	if(r < sCtxL || l > sCtxR || b < sCtxT || t > sCtxB) return; // cropped away
+
+	// partially cropped text needs the scissor
+	if(l < sCtxL || r > sCtxR || t < sCtxT || b > sCtxB){
+		draw::color(c);
+		render(v, x, y);
+		return;
+	}
+
+	GraphicsData& gd = batchFor(mLineWidth);
+	for(unsigned i=0; i<n; i+=2){
+		gd.addVertex2(g[i]+ox, g[i+1]+oy);
+		gd.addColor(c);
+	}
+	if(sBatchL > sBatchR){
+		sBatchL = l; sBatchT = t; sBatchR = r; sBatchB = b;
+	}
+	else{
+		if(l < sBatchL) sBatchL = l;
+		if(t < sBatchT) sBatchT = t;
+		if(r > sBatchR) sBatchR = r;
+		if(b > sBatchB) sBatchB = b;
+	}
+}
+
+void Font::batchContext(float x, float y, float l, float t, float r, float b){
+	sCtxX = x; sCtxY = y;
+	sCtxL = l; sCtxT = t; sCtxR = r; sCtxB = b;
+}
+
+void Font::beginBatch(){
+	sBatching = true;
+}
 
-//	glv::text(v, 0,0, lineSpacing(), tabSpaces(), mScaleY);
+void Font::endBatch(){
+	sBatching = false;
+	flushBatch();
+}
+
+bool Font::batchOverlaps(float l, float t, float w, float h){
+	if(sBatchL > sBatchR) return false;
+	return (l <= sBatchR+1) && (sBatchL <= l+w+1) && (t <= sBatchB+1) && (sBatchT <= t+h+1);
+}
+
+void Font::flushBatch(){
+	using namespace glv::draw;
+	if(sBatchL > sBatchR) return;
+
+	// batched text was inside the scissor box it was rendered with
+	bool scissored = glIsEnabled(GL_SCISSOR_TEST);
+	if(scissored) draw::disable(ScissorTest);
+
+	draw::push(ModelView);
+	draw::identity();
+	for(unsigned i=0; i<sBatches.size(); ++i){
+		GraphicsData& gd = sBatches[i]->data;
+		if(gd.vertices2().size()){
+			glLineWidth(sBatches[i]->lineWidth);
+			draw::paint(draw::Lines, gd);
+		}
+		gd.reset();
+	}
 	draw::pop(ModelView);
+
+	if(scissored) draw::enable(ScissorTest);
+	sBatchL = 1; sBatchT = 1; sBatchR = 0; sBatchB = 0;
 }
 
-Font& Font::letterSpacing(float v){ mLetterSpacing=v; return *this; }
+Font& Font::letterSpacing(float v){ if(v!=mLetterSpacing) mCache.clear(); mLetterSpacing=v; return *this; }
+
+Font& Font::lineSpacing(float v){ if(v!=mLineSpacing) mCache.clear(); mLineSpacing=v; return *this; }
 
-Font& Font::lineSpacing(float v){ mLineSpacing=v; return *this; }
+Font& Font::lineWidth(float v){ mLineWidth=v; return *this; }
 
 Font& Font::size(unsigned v){
 	mSize = v;
@@ -310,7 +428,7 @@ Font& Font::size(unsigned v){
 	return *this;
 }
 
-Font& Font::tabSpaces(unsigned v){ mTabSpaces=v; return *this; }
+Font& Font::tabSpaces(unsigned v){ if(v!=mTabSpaces) mCache.clear(); mTabSpaces=v; return *this; }
 
 float Font::advance(const char *text) const {
 	return advance(' ') * strlen(text);
@@ -3,10 +3,31 @@
 
 #include "glv_core.h"
 
+#ifdef GLV_PLATFORM_WIN
+	#include <windows.h>
+#else
+	#include <sys/time.h>
+#endif
+
 namespace glv{
 
+// wall clock in seconds for frame statistics
+static double frameClock(){
+#ifdef GLV_PLATFORM_WIN
+	LARGE_INTEGER f, c;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&c);
+	return double(c.QuadPart) / double(f.QuadPart);
+#else
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
 GLV::GLV(drawCallback cb, space_t width, space_t height)
-:	View(0, 0, width, height, cb), mFocusedView(this)
+:	View(0, 0, width, height, cb), mFocusedView(this), mRefresh(true),
+	mViewsVisited(0), mViewsDrawn(0), mDrawCalls(0), mFrames(0), mDrawTime(0)
 {
 	disable(DrawBorder | FocusHighlight);
 //	cloneStyle();
@@ -104,8 +125,14 @@ void GLV::doFocusCallback(bool get){
 }
 
 void GLV::drawGLV(unsigned int w, unsigned int h, double dsec){
+	mRefresh = false;	// drawing code may request the next frame again
+	double t0 = frameClock();
+	unsigned calls = draw::drawCallCount;
 	glDrawBuffer(GL_BACK);
 	drawWidgets(w, h, dsec);
+	mDrawCalls = draw::drawCallCount - calls;
+	mDrawTime = frameClock() - t0;
+	++mFrames;
 }
 
 
@@ -125,6 +152,8 @@ static void drawContext(float tx, float ty, View * v, float& cx, float& cy, View
 }
 
 static void computeCrop(std::vector<Rect>& cr, int lvl, space_t ax, space_t ay, View * v){
+	if(lvl >= (int)cr.size()) cr.resize(cr.size()*2);	// grows with the deepest hierarchy seen
+	
 	if(v->enabled(CropChildren)){
 		cr[lvl].set(ax, ay, v->w, v->h);	// set absolute rect
 		
@@ -136,6 +165,12 @@ static void computeCrop(std::vector<Rect>& cr, int lvl, space_t ax, space_t ay,
 	else{ cr[lvl] = cr[lvl-1]; }
 }
 
+// Whether anything drawn inside r would survive the scissor for crop rect c.
+// The scissor is one pixel larger than the crop rect, see drawWidgets().
+static bool cropVisible(const Rect& c, space_t l, space_t t, space_t w, space_t h){
+	return (l <= c.right()+1) && (c.l <= l+w+1) && (t <= c.bottom()+1) && (c.t <= t+h+1);
+}
+
 // Views are drawn depth-first from leftmost to rightmost sibling
 void GLV::drawWidgets(unsigned int w, unsigned int h, double dsec){
 	using namespace draw;
@@ -145,16 +180,23 @@ void GLV::drawWidgets(unsigned int w, unsigned int h, double dsec){
 	View * cv = root;
 
 	// The crop region is the intersection of all parent rects up to the top 
-	// view. The intersections also need to be done in absolute coordinates.	
-	std::vector<Rect> cropRects(16, Rect(w, h));	// index is hierarchy level
+	// view. The intersections also need to be done in absolute coordinates.
+	// The rects are kept between frames so that drawing does not allocate.
+	std::vector<Rect>& cropRects = mCropRects;	// index is hierarchy level
+	if(cropRects.empty()) cropRects.resize(16);
+	cropRects[0].set(0, 0, w, h);
 	int lvl = 0;	// start at root = 0
 	
+	mViewsVisited = 1;
+	mViewsDrawn = 1;
+	
 	glEnableClientState(GL_VERTEX_ARRAY);
 	glEnableClientState(GL_INDEX_ARRAY);
 	//glEnableClientState(GL_COLOR_ARRAY); // note: enabling this messes up glColor, so leave it off
 	//glColorPointer(4, GL_FLOAT, 0, 0);
 
 	push2D(w, h);	// initialise the OpenGL renderer for our 2D GUI world
+	Font::beginBatch();
 
 	graphicsData().reset();
 	if(enabled(Animate)) onAnimate(dsec, *this);
@@ -164,15 +206,16 @@ void GLV::drawWidgets(unsigned int w, unsigned int h, double dsec){
 	
 	draw::enable(ScissorTest);
 
+	onDataModelSync();
+	rectifyGeometry();
+	bool descend = visible();	// whether the subtree of cv can produce any pixels
+
 	while(true){
 
-		cv->onDataModelSync();		// update state based on attached model variables
-		cv->rectifyGeometry();
-	
 		// find the next view to draw
 		
 		// go to child node if exists and I'm drawable
-		if(cv->child && cv->visible()){
+		if(cv->child && descend){
 			drawContext(cv->child->l, cv->child->t, cv->child, cx, cy, cv);
 			computeCrop(cropRects, ++lvl, cx, cy, cv);
 		}
@@ -197,23 +240,45 @@ void GLV::drawWidgets(unsigned int w, unsigned int h, double dsec){
 			else break; // break the loop when the traversal returns to the root
 		}
 		
+		++mViewsVisited;
+		cv->rectifyGeometry();
+		
+		// A view with CropChildren whose rect is outside the parent crop has
+		// an empty child crop, so its whole subtree can be skipped. Views
+		// without it may have children outside their own rect and are
+		// always descended into.
+		const Rect& pr = cropRects[lvl-1];	// cropping region comes from parent context
+		bool inside = cropVisible(pr, cx, cy, cv->w, cv->h);
+		descend = cv->visible() && (inside || !cv->enabled(CropChildren));
 		
-		// draw the current view
-		if(cv->visible()){
+		// draw the current view, unless its own drawing would be cropped away
+		if(cv->visible() && (inside || !cv->enabled(CropSelf))){
 
-			Rect r = cropRects[lvl-1];	// cropping region comes from parent context
+			cv->onDataModelSync();		// update state based on attached model variables
+			++mViewsDrawn;
+
+			Rect r = pr;
 			if(cv->enabled(CropSelf)) r.intersection(Rect(cx, cy, cv->w, cv->h), r); // crop my own draw?
 
+			// text batched so far must not end up on top of this view
+			if(Font::batchOverlaps(r.l, r.t, r.w, r.h)) Font::flushBatch();
+
 			// LJP: using some weird numbers here, seems to work right though...
 			//scissor(r.l, h - r.bottom() - 1, r.w+2, r.h+1);
 			scissor(pix(r.l), pix(h - r.bottom() - 1.499), pix(r.w+1), pix(r.h+1.499));
 
+			Font::batchContext(pix(cx) + 0.5, pix(cy) + 0.5, r.l, r.t, r.right(), r.bottom());
 			graphicsData().reset();
 			if(cv->enabled(Animate)) cv->onAnimate(dsec, *this);
 			cv->doDraw(*this);
 		}
 	}
 	
+	// the remaining batched text. views drawn over batched text flushed it
+	// before drawing, text that needed cropping was drawn right away.
+	scissor(0,0,(GLint)w,(GLint)h);
+	Font::endBatch();
+
 	glDisableClientState(GL_INDEX_ARRAY);
 	glDisableClientState(GL_VERTEX_ARRAY);
 	//glDisableClientState(GL_COLOR_ARRAY);
@@ -73,10 +73,15 @@ Label& Label::vertical(bool v){
 void Label::onDraw(GLV& g){
 	using namespace glv::draw;
 	lineWidth(1);
-	color(colors().text);
-	if(mVertical){ translate(0,h); rotate(0,0,-90); }
+	if(mVertical){
+		color(colors().text);
+		translate(0,h); rotate(0,0,-90);
+		font().render(data().toString().c_str());
+	}
+	else{
+		font().renderBatched(data().toString().c_str(), 0, 0, colors().text);
+	}
 	//font().render(value().c_str());
-	font().render(data().toString().c_str());
 	//scale(mSize, mSize);
 	//text(value().c_str());
 }
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <ctype.h>		// isalnum
+#include <math.h>		// floor
 #include "glv_core.h"
 
 namespace glv{
@@ -13,7 +14,7 @@ namespace glv{
 	draw(cb),\
 	mFlags(Visible | DrawBack | DrawBorder | CropSelf | FocusHighlight | FocusToTop | HitTest | Controllable | Animate), \
 	mStyle(&(Style::standard())), mAnchorX(0), mAnchorY(0), mStretchX(0), mStretchY(0), \
-	mFont(0)
+	mFont(0), mChildIndex(0)
 
 View::View(space_t left, space_t top, space_t width, space_t height, drawCallback cb)
 :	Rect(left, top, width, height), VIEW_INIT
@@ -58,6 +59,7 @@ View::~View(){
 	}
 
 	delete mFont;
+	delete mChildIndex;
 }
 
 
@@ -87,6 +89,8 @@ void View::add(View& newChild){
 		while(lastChild->sibling) lastChild = lastChild->sibling;
 		lastChild->sibling = &newChild;
 	}
+	
+	if(mChildIndex) mChildIndex->insert(newChild);
 }
 
 
@@ -103,6 +107,8 @@ void View::remove(){
 	// note that this doesn't delete the view, it just removes it from the hierarchy
 	if(parent && parent->child){	// sanity check: don't try to remove a window or an unattached view
 
+		if(parent->mChildIndex) parent->mChildIndex->remove(*this);
+
 		// re-patch parent's child?
 		if(parent->child == this){
 			// I'm my parent's first child 
@@ -272,13 +278,18 @@ View * View::findTarget(space_t &x, space_t &y){
 	while(n->child){
 	
 		// target may be the child or one of its siblings
-		View * sib = n->child;
 		View * match = 0;
 		
-		// Iterate through siblings
-		while(sib){
-			if(sib->containsPoint(x,y) && sib->visible()) match = sib;
-			sib = sib->sibling;
+		if(n->mChildIndex){
+			match = n->mChildIndex->find(x,y);
+		}
+		else{
+			// Iterate through siblings
+			View * sib = n->child;
+			while(sib){
+				if(sib->containsPoint(x,y) && sib->visible()) match = sib;
+				sib = sib->sibling;
+			}
 		}
 		
 		// we found a sibling target; update the relative x & y & run the main while() again
@@ -427,7 +438,14 @@ void View::onDraw(GLV& g){ if(draw) draw(this, g); }
 bool View::onEvent(Event::t e, GLV& g){ return true; }
 
 
+void View::onMove(space_t dx, space_t dy){
+	if(parent && parent->mChildIndex) parent->mChildIndex->update(*this);
+}
+
+
 void View::onResize(space_t dx, space_t dy){
+	if(parent && parent->mChildIndex) parent->mChildIndex->update(*this);
+
 	// Move/resize anchored children
 	// This will recursively call onResize's through the entire tree
 	View * v = child;	
@@ -515,6 +533,27 @@ void View::rectifyGeometry(){
 		if(right() > maxw) right(maxw);
 		if(bottom() > maxh) bottom(maxh);
 	}
+	
+	// catch geometry changes made without the setters
+	if(parent && parent->mChildIndex && !parent->mChildIndex->current(*this)){
+		parent->mChildIndex->update(*this);
+	}
+}
+
+
+View& View::indexChildren(space_t cellW, space_t cellH){
+	delete mChildIndex;
+	mChildIndex = 0;
+
+	if(cellW > 0 && cellH > 0){
+		mChildIndex = new ChildIndex(cellW, cellH);
+		View * v = child;
+		while(v){
+			mChildIndex->insert(*v);
+			v = v->sibling;
+		}
+	}
+	return *this;
 }
 
 
@@ -608,4 +647,122 @@ TRAVERSE_DEPTH(Const, const)
 
 //std::string View::valueString() const { std::string r; valueToString(r); return r; }
 
+// ChildIndex __________________________________________________________________
+
+// children spanning more cells than this are not put into the grid
+#define GLV_CHILD_INDEX_MAX_CELLS 64
+
+ChildIndex::ChildIndex(space_t cellW, space_t cellH)
+:	mCellW(cellW), mCellH(cellH), mOrder(0)
+{}
+
+void ChildIndex::cellRange(const Rect& r, int& x0, int& y0, int& x1, int& y1) const{
+	x0 = (int)::floor(r.l / mCellW);
+	y0 = (int)::floor(r.t / mCellH);
+	x1 = (int)::floor(r.right() / mCellW);	// edges are inclusive, see containsPoint()
+	y1 = (int)::floor(r.bottom() / mCellH);
+}
+
+void ChildIndex::bucket(View& v, Entry& e, bool add){
+	if(add){
+		int x0,y0,x1,y1;
+		cellRange(e.rect, x0,y0,x1,y1);
+		e.oversized = double(x1-x0+1) * double(y1-y0+1) > GLV_CHILD_INDEX_MAX_CELLS;
+	}
+
+	if(e.oversized){
+		if(add) mOversized.push_back(&v);
+		else mOversized.erase(std::find(mOversized.begin(), mOversized.end(), &v));
+		return;
+	}
+
+	int x0,y0,x1,y1;
+	cellRange(e.rect, x0,y0,x1,y1);
+	for(int j=y0; j<=y1; ++j){
+	for(int i=x0; i<=x1; ++i){
+		if(add){
+			mGrid[Cell(i,j)].push_back(&v);
+		}
+		else{
+			Grid::iterator it = mGrid.find(Cell(i,j));
+			if(it == mGrid.end()) continue;
+			std::vector<View *>& c = it->second;
+			c.erase(std::find(c.begin(), c.end(), &v));
+			if(c.empty()) mGrid.erase(it);
+		}
+	}}
+}
+
+void ChildIndex::insert(View& v){
+	remove(v);
+	Entry& e = mEntries[&v];
+	e.rect = v;
+	e.order = ++mOrder;
+	bucket(v, e, true);
+}
+
+void ChildIndex::remove(View& v){
+	std::map<const View *, Entry>::iterator it = mEntries.find(&v);
+	if(it == mEntries.end()) return;
+	bucket(v, it->second, false);
+	mEntries.erase(it);
+}
+
+void ChildIndex::update(View& v){
+	std::map<const View *, Entry>::iterator it = mEntries.find(&v);
+	if(it == mEntries.end()) return;
+	Entry& e = it->second;
+
+	int ox0,oy0,ox1,oy1, nx0,ny0,nx1,ny1;
+	cellRange(e.rect, ox0,oy0,ox1,oy1);
+	cellRange(v, nx0,ny0,nx1,ny1);
+	
+	// moves within the same cells only need the new rect
+	if(ox0!=nx0 || oy0!=ny0 || ox1!=nx1 || oy1!=ny1){
+		bucket(v, e, false);
+		e.rect = v;
+		bucket(v, e, true);
+	}
+	else{
+		e.rect = v;
+	}
+}
+
+bool ChildIndex::current(const View& v) const{
+	std::map<const View *, Entry>::const_iterator it = mEntries.find(&v);
+	if(it == mEntries.end()) return true;
+	const Rect& r = it->second.rect;
+	return r.l == v.l && r.t == v.t && r.w == v.w && r.h == v.h;
+}
+
+void ChildIndex::clear(){
+	mEntries.clear();
+	mGrid.clear();
+	mOversized.clear();
+}
+
+View * ChildIndex::find(space_t x, space_t y) const{
+	View * match = 0;
+	unsigned order = 0;
+
+	Grid::const_iterator it = mGrid.find(Cell((int)::floor(x / mCellW), (int)::floor(y / mCellH)));
+	
+	for(int k=0; k<2; ++k){
+		const std::vector<View *> * c = &mOversized;
+		if(k == 1){
+			if(it == mGrid.end()) break;
+			c = &it->second;
+		}
+		for(unsigned i=0; i<c->size(); ++i){
+			View * v = (*c)[i];
+			if(v->containsPoint(x,y) && v->visible()){
+				unsigned o = mEntries.find(v)->second.order;
+				if(o >= order){ match = v; order = o; }
+			}
+		}
+	}
+	return match;
+}
+
+
 } // glv::
@@ -108,6 +108,43 @@ int main(){
 	}
 
 	
+	// test child index hit testing
+	{
+		View top(Rect(0,0,1000,1000));
+		View a(Rect(10,10,20,20)), b(Rect(20,20,20,20)), c(Rect(500,500,20,20)), big(Rect(0,0,1000,1000));
+		top << a << b << c;
+		top.indexChildren(50,50);
+		assert(top.childIndex()->size() == 3);
+		
+		space_t x=25, y=25;
+		assert(top.findTarget(x,y) == &b);	// overlapping: last sibling wins
+		assert(x==5 && y==5);
+		
+		a.makeLastSibling();
+		x=25; y=25; assert(top.findTarget(x,y) == &a);
+		
+		c.pos(100,100);						// moved through setter
+		x=510; y=510; assert(top.findTarget(x,y) == &top);
+		x=110; y=110; assert(top.findTarget(x,y) == &c);
+		
+		c.l = 700;							// direct write, picked up by rectifyGeometry()
+		c.rectifyGeometry();
+		x=710; y=110; assert(top.findTarget(x,y) == &c);
+		
+		c.disable(Visible);
+		x=710; y=110; assert(top.findTarget(x,y) == &top);
+		
+		top << big;							// oversized
+		x=900; y=900; assert(top.findTarget(x,y) == &big);
+		big.remove();
+		x=900; y=900; assert(top.findTarget(x,y) == &top);
+		assert(top.childIndex()->size() == 3);
+		
+		top.indexChildren(0,0);
+		assert(!top.childIndex());
+	}
+
+	
 	// test View memory management
 	{
 		View * v0d = new View;
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "journal.h"
+
+#define JOURNAL_VERSION 2 // 2: tracks are put back with (track-insert)
+
+struct JournalOp {
+  int replace;      // write a new journal file instead of appending
+  std::string path;
+  std::string data;
+  std::function<void(std::string&)> build; // appends the rest of data
+};
+
+static std::mutex journal_mutex;
+static std::condition_variable journal_cond;
+static std::deque<JournalOp> journal_queue;
+static std::thread journal_thread;
+static bool journal_quit = false;
+
+static std::string journal_project;
+static size_t journal_bytes = 0;
+static int journal_fd = -1; // writer thread only
+
+static std::string journal_path(const std::string& project) {
+  return project+".journal";
+}
+
+// size -1 stands for an empty project
+static std::string journal_header(const char* project, int from_file) {
+  long long size = -1;
+  long long mtime = 0;
+  struct stat st;
+  if (from_file && !stat(project, &st)) {
+    size = st.st_size;
+    mtime = st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec;
+  }
+  char buf[128];
+  snprintf(buf,127,"(journal %d %lld %lld)\n",JOURNAL_VERSION,size,mtime);
+  return std::string(buf);
+}
+
+static int write_all(int fd, const char* p, size_t len) {
+  while (len) {
+    ssize_t w = write(fd, p, len);
+    if (w<0) return 0;
+    p += w;
+    len -= w;
+  }
+  return 1;
+}
+
+static void flush_lines(std::string& lines) {
+  if (journal_fd<0 || !lines.size()) return;
+  if (!write_all(journal_fd, lines.data(), lines.size()) || fdatasync(journal_fd)) {
+    printf("journal: write failed\n");
+  }
+  lines.clear();
+}
+
+// written to a temporary file first so that a crash leaves either the old or
+// the new journal
+static void replace_journal(const std::string& path, const std::string& data) {
+  if (journal_fd>=0) close(journal_fd);
+  journal_fd = -1;
+
+  std::string tmp = path+".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd<0) {
+    printf("journal: cannot write %s\n",tmp.c_str());
+    return;
+  }
+  int ok = write_all(fd, data.data(), data.size()) && !fsync(fd);
+  if (close(fd)) ok = 0;
+  if (!ok || rename(tmp.c_str(), path.c_str())) {
+    printf("journal: cannot write %s\n",path.c_str());
+    remove(tmp.c_str());
+    return;
+  }
+
+  // make the rename itself durable
+  char* dir_buf = strdup(path.c_str());
+  int dir = open(dirname(dir_buf), O_RDONLY);
+  if (dir>=0) {
+    fsync(dir);
+    close(dir);
+  }
+  free(dir_buf);
+
+  journal_fd = open(path.c_str(), O_WRONLY|O_APPEND);
+}
+
+static void journal_writer() {
+  std::unique_lock<std::mutex> lock(journal_mutex);
+  while (true) {
+    journal_cond.wait(lock, [] { return journal_queue.size() || journal_quit; });
+    if (!journal_queue.size()) break;
+
+    std::deque<JournalOp> batch;
+    batch.swap(journal_queue);
+    lock.unlock();
+
+    std::string lines;
+    for (JournalOp& op : batch) {
+      if (op.replace) {
+        flush_lines(lines);
+        if (op.build) op.build(op.data);
+        replace_journal(op.path, op.data);
+      } else {
+        lines += op.data;
+      }
+    }
+    flush_lines(lines);
+
+    lock.lock();
+  }
+  if (journal_fd>=0) close(journal_fd);
+  journal_fd = -1;
+}
+
+static void journal_push(int replace, const std::string& data, const std::function<void(std::string&)>& build = nullptr) {
+  std::lock_guard<std::mutex> lock(journal_mutex);
+  if (!journal_thread.joinable()) {
+    journal_quit = false;
+    journal_thread = std::thread(journal_writer);
+  }
+  JournalOp op = {replace, journal_path(journal_project), data, build};
+  journal_queue.push_back(op);
+  journal_cond.notify_one();
+}
+
+void journal_start(const char* project, int from_file) {
+  journal_project = project;
+  journal_bytes = 0;
+  journal_push(1, journal_header(project, from_file));
+}
+
+void journal_resume(const char* project, int from_file, const std::vector<std::string>& entries) {
+  std::string data = journal_header(project, from_file);
+  size_t header = data.size();
+  for (const std::string& e : entries) {
+    data += e;
+    data += '\n';
+  }
+  journal_project = project;
+  journal_bytes = data.size()-header;
+  journal_push(1, data);
+}
+
+void journal_snapshot(const std::function<void(std::string&)>& build) {
+  if (!journal_project.size()) return;
+  journal_bytes = 0;
+  journal_push(1, journal_header(journal_project.c_str(), 0), build);
+}
+
+void journal_append(const std::string& line) {
+  if (!journal_project.size()) return;
+  journal_bytes += line.size()+1;
+  journal_push(0, line+"\n");
+}
+
+size_t journal_size() {
+  return journal_bytes;
+}
+
+int journal_read(const char* project, int* from_file, std::vector<std::string>* entries) {
+  FILE* f = fopen(journal_path(project).c_str(), "r");
+  if (!f) return 0;
+
+  char* line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+
+  int version = 0;
+  long long size = -1;
+  long long mtime = 0;
+  int ok = (len = getline(&line, &cap, f))>0
+    && sscanf(line, "(journal %d %lld %lld)", &version, &size, &mtime)==3
+    && version==JOURNAL_VERSION;
+
+  // entries of a project file that was saved again since are stale
+  *from_file = size>=0;
+  if (ok && *from_file) {
+    struct stat st;
+    ok = !stat(project, &st) && st.st_size==size
+      && st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec==mtime;
+  }
+
+  // a line without newline was cut off by a crash
+  entries->clear();
+  while (ok && (len = getline(&line, &cap, f))>0 && line[len-1]=='\n') {
+    if (len>1) entries->push_back(std::string(line, len-1));
+  }
+  free(line);
+  fclose(f);
+
+  return ok && entries->size();
+}
+
+void journal_stop() {
+  {
+    std::lock_guard<std::mutex> lock(journal_mutex);
+    journal_quit = true;
+    journal_cond.notify_one();
+  }
+  if (journal_thread.joinable()) journal_thread.join();
+}
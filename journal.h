@@ -0,0 +1,44 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+// append-only edit journal kept next to the project as <project>.journal.
+// the first line records the state the entries apply to: the saved project
+// file (its size and mtime) or an empty project. every further line is one
+// lisp form that replays one edit step. lines are written and fsynced by a
+// background thread; lines queued while a sync is running are committed
+// together with the next one.
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// starts a new, empty journal for project. from_file: the entries apply to
+// the saved project file, otherwise to an empty project.
+void journal_start(const char* project, int from_file);
+
+// starts the journal for project with entries already in it, e.g. the ones
+// journal_read() returned and that were replayed. written in one go like
+// journal_start(), so a crash leaves either the old or the new journal.
+void journal_resume(const char* project, int from_file, const std::vector<std::string>& entries);
+
+// replaces the journal of the current project with lines that rebuild the
+// whole project from an empty one. build appends them and runs on the writer
+// thread, in order with the lines queued before and after; it must only read
+// data it owns. does nothing without a journal.
+void journal_snapshot(const std::function<void(std::string&)>& build);
+
+// queues one line, without the trailing newline
+void journal_append(const std::string& line);
+
+// bytes queued since the journal was started or snapshotted
+size_t journal_size();
+
+// reads the complete lines of the journal of project into entries. returns 1
+// if there are entries that still apply; *from_file tells whether they apply
+// to the saved project file or to an empty project.
+int journal_read(const char* project, int* from_file, std::vector<std::string>* entries);
+
+// writes everything queued and ends the writer thread
+void journal_stop();
+
+#endif
@@ -118,6 +118,7 @@ void  enter_scope();
 void  exit_scope();
 char* lisp_write(Cell* cell, char* buffer, int bufsize);
 Cell* get_globals();
+Cell* lookup_symbol(Cell* sym, Cell* env);
 void  register_alien_func(char* symname, alien_func func);
 
 void  print_memstats();
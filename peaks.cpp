@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <thread>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "peaks.h"
+
+#define PEAKS_VERSION 1
+
+struct PeaksFileHeader {
+  char magic[4]; // "PEAK"
+  uint32_t version;
+  uint32_t num_samples;
+  uint32_t num_levels;
+  int64_t source_size; // cache is stale if the sample file changed
+  int64_t source_mtime;
+};
+
+// min, max and sum of squares of len>0 samples
+static void block_stats(const float* p, uint32_t len, float* mn, float* mx, float* sumsq) {
+  uint32_t i = 0;
+  float vmn = p[0];
+  float vmx = p[0];
+  float vsq = 0;
+
+#if defined(__SSE__)
+  if (len>=4) {
+    __m128 mn4 = _mm_loadu_ps(p);
+    __m128 mx4 = mn4;
+    __m128 sq4 = _mm_setzero_ps();
+    for (; i+4<=len; i+=4) {
+      __m128 v = _mm_loadu_ps(p+i);
+      mn4 = _mm_min_ps(mn4, v);
+      mx4 = _mm_max_ps(mx4, v);
+      sq4 = _mm_add_ps(sq4, _mm_mul_ps(v, v));
+    }
+    float a[4], b[4], c[4];
+    _mm_storeu_ps(a, mn4);
+    _mm_storeu_ps(b, mx4);
+    _mm_storeu_ps(c, sq4);
+    for (int j=0; j<4; j++) {
+      if (a[j]<vmn) vmn = a[j];
+      if (b[j]>vmx) vmx = b[j];
+      vsq += c[j];
+    }
+  }
+#endif
+
+  for (; i<len; i++) {
+    float v = p[i];
+    if (v<vmn) vmn = v;
+    if (v>vmx) vmx = v;
+    vsq += v*v;
+  }
+  *mn = vmn;
+  *mx = vmx;
+  *sumsq = vsq;
+}
+
+static void build_base_level(const float* pcm, uint32_t n, PeakLevel* l) {
+  uint32_t count = (n+PEAKS_BASE_BLOCK-1)/PEAKS_BASE_BLOCK;
+  l->block = PEAKS_BASE_BLOCK;
+  l->min.resize(count);
+  l->max.resize(count);
+  l->rms.resize(count);
+
+  for (uint32_t b=0; b<count; b++) {
+    uint32_t start = b*PEAKS_BASE_BLOCK;
+    uint32_t len = n-start;
+    if (len>PEAKS_BASE_BLOCK) len = PEAKS_BASE_BLOCK;
+
+    float sumsq;
+    block_stats(pcm+start, len, &l->min[b], &l->max[b], &sumsq);
+    l->rms[b] = sqrtf(sumsq/len);
+  }
+}
+
+// 2x decimation of src into dst
+static void build_level(const PeakLevel* src, PeakLevel* dst) {
+  uint32_t n = src->min.size();
+  uint32_t count = (n+1)/2;
+  dst->block = src->block*2;
+  dst->min.resize(count);
+  dst->max.resize(count);
+  dst->rms.resize(count);
+
+  const float* smin = &src->min[0];
+  const float* smax = &src->max[0];
+  const float* srms = &src->rms[0];
+  uint32_t i = 0;
+
+#if defined(__SSE__)
+  // 8 source entries -> 4 destination entries, pairs are split into
+  // even/odd vectors with shuffles
+  __m128 half = _mm_set1_ps(0.5f);
+  for (; 2*i+8<=n; i+=4) {
+    __m128 a, b, even, odd;
+
+    a = _mm_loadu_ps(smin+2*i);
+    b = _mm_loadu_ps(smin+2*i+4);
+    even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+    odd  = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+    _mm_storeu_ps(&dst->min[i], _mm_min_ps(even, odd));
+
+    a = _mm_loadu_ps(smax+2*i);
+    b = _mm_loadu_ps(smax+2*i+4);
+    even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+    odd  = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+    _mm_storeu_ps(&dst->max[i], _mm_max_ps(even, odd));
+
+    a = _mm_loadu_ps(srms+2*i);
+    b = _mm_loadu_ps(srms+2*i+4);
+    even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+    odd  = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+    __m128 sq = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(even, even), _mm_mul_ps(odd, odd)), half);
+    _mm_storeu_ps(&dst->rms[i], _mm_sqrt_ps(sq));
+  }
+#endif
+
+  for (; i<count; i++) {
+    uint32_t j = 2*i;
+    if (j+1<n) {
+      dst->min[i] = smin[j]<smin[j+1] ? smin[j] : smin[j+1];
+      dst->max[i] = smax[j]>smax[j+1] ? smax[j] : smax[j+1];
+      dst->rms[i] = sqrtf((srms[j]*srms[j] + srms[j+1]*srms[j+1])*0.5f);
+    } else {
+      dst->min[i] = smin[j];
+      dst->max[i] = smax[j];
+      dst->rms[i] = srms[j];
+    }
+  }
+}
+
+static void build_pyramid(const float* pcm, uint32_t n, PeakPyramid* p) {
+  p->levels.clear();
+  p->levels.push_back(PeakLevel());
+  build_base_level(pcm, n, &p->levels[0]);
+
+  while (p->levels.back().min.size()>1) {
+    PeakLevel next;
+    build_level(&p->levels.back(), &next);
+    p->levels.push_back(next);
+  }
+}
+
+static std::string cache_path(const std::string& path) {
+  return path+".peaks";
+}
+
+static int source_stat(const std::string& path, PeaksFileHeader* h) {
+  struct stat st;
+  if (stat(path.c_str(), &st)) return 0;
+  h->source_size = st.st_size;
+  h->source_mtime = st.st_mtime;
+  return 1;
+}
+
+static int read_cache(const std::string& path, PeakPyramid* p) {
+  PeaksFileHeader expected;
+  if (!source_stat(path, &expected)) return 0;
+
+  FILE* f = fopen(cache_path(path).c_str(), "rb");
+  if (!f) return 0;
+
+  PeaksFileHeader h;
+  int ok = fread(&h, sizeof(h), 1, f)==1
+    && !memcmp(h.magic, "PEAK", 4)
+    && h.version==PEAKS_VERSION
+    && h.num_samples==p->num_samples
+    && h.source_size==expected.source_size
+    && h.source_mtime==expected.source_mtime
+    && h.num_levels<=32;
+
+  // level i has blocks of PEAKS_BASE_BLOCK << i samples, as build_pyramid()
+  // makes them, and one entry per started block
+  p->levels.clear();
+  for (uint32_t i=0; ok && i<h.num_levels; i++) {
+    uint32_t info[2]; // block, count
+    uint64_t block = (uint64_t)PEAKS_BASE_BLOCK<<i;
+    if (fread(info, sizeof(info), 1, f)!=1 || info[0]!=block
+        || info[1]!=(h.num_samples+block-1)/block) {
+      ok = 0;
+      break;
+    }
+    PeakLevel l;
+    l.block = info[0];
+    l.min.resize(info[1]);
+    l.max.resize(info[1]);
+    l.rms.resize(info[1]);
+    ok = fread(&l.min[0], sizeof(float), info[1], f)==info[1]
+      && fread(&l.max[0], sizeof(float), info[1], f)==info[1]
+      && fread(&l.rms[0], sizeof(float), info[1], f)==info[1];
+    p->levels.push_back(l);
+  }
+  fclose(f);
+
+  if (!ok || !p->levels.size()) {
+    p->levels.clear();
+    return 0;
+  }
+  return 1;
+}
+
+// written to a temporary file first so that readers never see a partial cache
+static int write_cache(const std::string& path, PeakPyramid* p) {
+  PeaksFileHeader h;
+  memset(&h, 0, sizeof(h));
+  if (!source_stat(path, &h)) return 0;
+  memcpy(h.magic, "PEAK", 4);
+  h.version = PEAKS_VERSION;
+  h.num_samples = p->num_samples;
+  h.num_levels = p->levels.size();
+
+  std::string dst = cache_path(path);
+  std::string tmp = dst+".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    printf("peaks: cannot write %s\n",tmp.c_str());
+    return 0;
+  }
+
+  int ok = fwrite(&h, sizeof(h), 1, f)==1;
+  for (uint32_t i=0; ok && i<h.num_levels; i++) {
+    PeakLevel& l = p->levels[i];
+    uint32_t info[2] = {l.block, (uint32_t)l.min.size()};
+    ok = fwrite(info, sizeof(info), 1, f)==1
+      && fwrite(&l.min[0], sizeof(float), info[1], f)==info[1]
+      && fwrite(&l.max[0], sizeof(float), info[1], f)==info[1]
+      && fwrite(&l.rms[0], sizeof(float), info[1], f)==info[1];
+  }
+  if (fclose(f)) ok = 0;
+
+  if (!ok || rename(tmp.c_str(), dst.c_str())) {
+    remove(tmp.c_str());
+    return 0;
+  }
+  return 1;
+}
+
+PeakPyramid* peaks_open(const char* path, const float* pcm, uint32_t num_samples, void (*on_ready)(PeakPyramid*)) {
+  PeakPyramid* p = new PeakPyramid;
+  p->num_samples = num_samples;
+  p->ready = false;
+
+  if (!pcm || !num_samples) return p;
+
+  std::string src(path);
+  std::thread([p, src, pcm, num_samples, on_ready]() {
+    if (!read_cache(src, p)) {
+      build_pyramid(pcm, num_samples, p);
+      write_cache(src, p);
+      printf("peaks: built %d levels for %s\n",(int)p->levels.size(),src.c_str());
+    }
+    p->ready = true;
+    if (on_ready) on_ready(p);
+  }).detach();
+
+  return p;
+}
+
+const PeakLevel* peaks_level_for(PeakPyramid* p, double samples_per_pixel) {
+  if (!p || !p->ready || !p->levels.size()) return NULL;
+
+  for (int i=p->levels.size()-1; i>0; i--) {
+    if (p->levels[i].block<=samples_per_pixel) return &p->levels[i];
+  }
+  return &p->levels[0];
+}
+
+int peaks_range(const PeakLevel* l, uint32_t from, uint32_t to, float* mn, float* mx, float* rms) {
+  uint32_t count = l->min.size();
+  uint32_t e0 = from/l->block;
+  uint32_t e1 = (to+l->block-1)/l->block;
+  if (e1>count) e1 = count;
+  if (e0>=e1) return 0;
+
+  float vmn = l->min[e0];
+  float vmx = l->max[e0];
+  float sq = 0;
+  for (uint32_t e=e0; e<e1; e++) {
+    if (l->min[e]<vmn) vmn = l->min[e];
+    if (l->max[e]>vmx) vmx = l->max[e];
+    sq += l->rms[e]*l->rms[e];
+  }
+  *mn = vmn;
+  *mx = vmx;
+  *rms = sqrtf(sq/(e1-e0));
+  return 1;
+}
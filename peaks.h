@@ -0,0 +1,40 @@
+#ifndef PEAKS_H
+#define PEAKS_H
+
+// multi-resolution waveform overview of a sample.
+// level 0 summarizes PEAKS_BASE_BLOCK samples per entry, every further
+// level halves the resolution. pyramids are built on a background thread
+// and cached next to the sample as <sample path>.peaks.
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#define PEAKS_BASE_BLOCK 64
+
+struct PeakLevel {
+  uint32_t block; // samples per entry
+  std::vector<float> min;
+  std::vector<float> max;
+  std::vector<float> rms;
+};
+
+struct PeakPyramid {
+  uint32_t num_samples;
+  std::vector<PeakLevel> levels;
+
+  std::atomic<bool> ready; // levels may only be read when set
+};
+
+// loads the cached pyramid of the sample at path or builds it from pcm in the
+// background. on_ready is called from the worker thread when done.
+PeakPyramid* peaks_open(const char* path, const float* pcm, uint32_t num_samples, void (*on_ready)(PeakPyramid*));
+
+// coarsest level that still has at least one entry per pixel, NULL if the
+// pyramid is not ready yet
+const PeakLevel* peaks_level_for(PeakPyramid* p, double samples_per_pixel);
+
+// summarizes samples [from,to) of a level; returns 0 if the range is empty
+int peaks_range(const PeakLevel* l, uint32_t from, uint32_t to, float* mn, float* mx, float* rms);
+
+#endif
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "projfile.h"
+
+uint32_t ProjFileData::add_string(const char* s) {
+  uint32_t offset = strings.size();
+  strings.append(s);
+  strings.push_back(0);
+  return offset;
+}
+
+// pointer to count elements of size bytes at offset, NULL if they don't fit
+static const void* section(const ProjFile* pf, uint64_t offset, uint64_t count, uint64_t size) {
+  if (offset%8 || offset>pf->map_size || count*size>pf->map_size-offset) return NULL;
+  return (const char*)pf->map+offset;
+}
+
+static int validate(ProjFile* pf) {
+  const ProjFileHeader* h = (const ProjFileHeader*)pf->map;
+  if (memcmp(h->magic, "PRJB", 4) || h->version!=PROJFILE_VERSION || h->file_size!=pf->map_size) return 0;
+  pf->header = h;
+
+  pf->tracks = (const ProjFileTrack*)section(pf, h->tracks_offset, h->num_tracks, sizeof(ProjFileTrack));
+  pf->region_id = (const uint32_t*)section(pf, h->region_id_offset, h->num_regions, sizeof(uint32_t));
+  pf->region_instrument = (const int32_t*)section(pf, h->region_instrument_offset, h->num_regions, sizeof(int32_t));
+  pf->region_inpoint = (const int64_t*)section(pf, h->region_inpoint_offset, h->num_regions, sizeof(int64_t));
+  pf->region_length = (const int64_t*)section(pf, h->region_length_offset, h->num_regions, sizeof(int64_t));
+  pf->lanes = (const ProjFileLane*)section(pf, h->lanes_offset, h->num_lanes, sizeof(ProjFileLane));
+  pf->point_time = (const int32_t*)section(pf, h->point_time_offset, h->num_points, sizeof(int32_t));
+  pf->point_value = (const int16_t*)section(pf, h->point_value_offset, h->num_points, sizeof(int16_t));
+  pf->strings = (const char*)section(pf, h->strings_offset, h->strings_size, 1);
+
+  if (!pf->tracks || !pf->region_id || !pf->region_instrument || !pf->region_inpoint || !pf->region_length
+      || !pf->lanes || !pf->point_time || !pf->point_value || !pf->strings) return 0;
+  if (!h->strings_size || pf->strings[h->strings_size-1]) return 0;
+
+  // the tracks partition the rows and lanes, the lanes the breakpoints
+  uint64_t rows = 0;
+  uint64_t lanes = 0;
+  for (uint32_t t=0; t<h->num_tracks; t++) {
+    const ProjFileTrack& tr = pf->tracks[t];
+    if (tr.type>1 || tr.path>=h->strings_size) return 0;
+
+    uint64_t end = rows+tr.num_regions;
+    if (end>h->num_regions) return 0;
+    for (uint64_t r=rows+1; r<end; r++) {
+      if (pf->region_inpoint[r-1]>pf->region_inpoint[r]) return 0;
+    }
+    rows = end;
+    lanes += tr.num_lanes;
+  }
+  if (rows!=h->num_regions || lanes!=h->num_lanes) return 0;
+
+  for (uint32_t r=0; r<h->num_regions; r++) {
+    int32_t i = pf->region_instrument[r];
+    if (i<-1 || i>=(int64_t)h->num_tracks || pf->region_length[r]<0) return 0;
+  }
+
+  uint64_t points = 0;
+  for (uint32_t l=0; l<h->num_lanes; l++) {
+    const ProjFileLane& lane = pf->lanes[l];
+    if (lane.type>2) return 0;
+
+    uint64_t end = points+lane.num_points;
+    if (end>h->num_points) return 0;
+    for (uint64_t p=points+1; p<end; p++) {
+      if (pf->point_time[p-1]>=pf->point_time[p]) return 0;
+    }
+    points = end;
+  }
+  return points==h->num_points;
+}
+
+int projfile_open(const char* path, ProjFile* pf) {
+  memset(pf, 0, sizeof(ProjFile));
+
+  int fd = open(path, O_RDONLY);
+  if (fd<0) return 0;
+
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size<(off_t)sizeof(ProjFileHeader)) {
+    close(fd);
+    return 0;
+  }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map==MAP_FAILED) return 0;
+
+  pf->map = map;
+  pf->map_size = st.st_size;
+  if (!validate(pf)) {
+    projfile_close(pf);
+    return 0;
+  }
+  return 1;
+}
+
+void projfile_close(ProjFile* pf) {
+  if (pf->map) munmap(pf->map, pf->map_size);
+  memset(pf, 0, sizeof(ProjFile));
+}
+
+static uint64_t align8(uint64_t offset) {
+  return (offset+7)&~(uint64_t)7;
+}
+
+static int write_section(FILE* f, uint64_t offset, const void* p, uint64_t bytes) {
+  static const char zeros[8] = {0};
+  long pos = ftell(f);
+  if (pos<0 || offset<(uint64_t)pos || fwrite(zeros, 1, offset-pos, f)!=offset-pos) return 0;
+  return !bytes || fwrite(p, 1, bytes, f)==bytes;
+}
+
+int projfile_write(const char* path, const ProjFileData& d) {
+  ProjFileHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "PRJB", 4);
+  h.version = PROJFILE_VERSION;
+  h.bpm = d.bpm;
+  h.num_tracks = d.tracks.size();
+  h.num_regions = d.region_id.size();
+  h.num_lanes = d.lanes.size();
+  h.num_points = d.point_time.size();
+  h.strings_size = d.strings.size();
+
+  uint64_t o = align8(sizeof(h));
+  h.tracks_offset = o;            o = align8(o+h.num_tracks*sizeof(ProjFileTrack));
+  h.region_id_offset = o;         o = align8(o+h.num_regions*sizeof(uint32_t));
+  h.region_instrument_offset = o; o = align8(o+h.num_regions*sizeof(int32_t));
+  h.region_inpoint_offset = o;    o = align8(o+h.num_regions*sizeof(int64_t));
+  h.region_length_offset = o;     o = align8(o+h.num_regions*sizeof(int64_t));
+  h.lanes_offset = o;             o = align8(o+h.num_lanes*sizeof(ProjFileLane));
+  h.point_time_offset = o;        o = align8(o+h.num_points*sizeof(int32_t));
+  h.point_value_offset = o;       o = align8(o+h.num_points*sizeof(int16_t));
+  h.strings_offset = o;           o = o+h.strings_size;
+  h.file_size = o;
+
+  std::string tmp = std::string(path)+".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    printf("projfile: cannot write %s\n",tmp.c_str());
+    return 0;
+  }
+
+  int ok = fwrite(&h, sizeof(h), 1, f)==1
+    && write_section(f, h.tracks_offset, d.tracks.data(), h.num_tracks*sizeof(ProjFileTrack))
+    && write_section(f, h.region_id_offset, d.region_id.data(), h.num_regions*sizeof(uint32_t))
+    && write_section(f, h.region_instrument_offset, d.region_instrument.data(), h.num_regions*sizeof(int32_t))
+    && write_section(f, h.region_inpoint_offset, d.region_inpoint.data(), h.num_regions*sizeof(int64_t))
+    && write_section(f, h.region_length_offset, d.region_length.data(), h.num_regions*sizeof(int64_t))
+    && write_section(f, h.lanes_offset, d.lanes.data(), h.num_lanes*sizeof(ProjFileLane))
+    && write_section(f, h.point_time_offset, d.point_time.data(), h.num_points*sizeof(int32_t))
+    && write_section(f, h.point_value_offset, d.point_value.data(), h.num_points*sizeof(int16_t))
+    && write_section(f, h.strings_offset, d.strings.data(), h.strings_size)
+    && !fflush(f) && !fsync(fileno(f));
+  if (fclose(f)) ok = 0;
+
+  if (!ok || rename(tmp.c_str(), path)) {
+    printf("projfile: cannot write %s\n",path);
+    remove(tmp.c_str());
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,102 @@
+#ifndef PROJFILE_H
+#define PROJFILE_H
+
+// binary project snapshot, the fast counterpart of the lisp project file.
+// a header is followed by sections at 8 byte aligned offsets: the track
+// table, the region columns (rows grouped by track in track order, sorted by
+// inpoint within a track), automation lanes, their breakpoint columns and a
+// table of NUL terminated strings. files are mapped and validated as a whole
+// before anything is read from them.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define PROJFILE_VERSION 1
+
+struct ProjFileHeader {
+  char magic[4]; // "PRJB"
+  uint32_t version;
+  uint64_t file_size; // truncated files are rejected
+  double bpm;
+  uint32_t num_tracks;
+  uint32_t num_regions;
+  uint32_t num_lanes;
+  uint32_t num_points;
+  uint32_t strings_size;
+  uint32_t reserved;
+
+  uint64_t tracks_offset;
+  uint64_t region_id_offset;
+  uint64_t region_instrument_offset;
+  uint64_t region_inpoint_offset;
+  uint64_t region_length_offset;
+  uint64_t lanes_offset;
+  uint64_t point_time_offset;
+  uint64_t point_value_offset;
+  uint64_t strings_offset;
+};
+
+struct ProjFileTrack {
+  uint32_t type; // track_type_t
+  uint32_t path; // sample path, offset into the string table
+  int32_t note;  // MIDI tracks
+  int32_t midi_port;
+  int32_t midi_channel;
+  int32_t r;
+  int32_t g;
+  int32_t b;
+  uint32_t num_regions; // rows following those of the previous tracks
+  uint32_t num_lanes;   // lanes following those of the previous tracks
+};
+
+struct ProjFileLane {
+  uint32_t type; // automation_type_t
+  int32_t controller;
+  uint32_t num_points; // breakpoints following those of the previous lanes
+  uint32_t reserved;
+};
+
+// a mapped project file; the arrays point into the mapping
+struct ProjFile {
+  const ProjFileHeader* header;
+  const ProjFileTrack* tracks;
+  const uint32_t* region_id;
+  const int32_t* region_instrument;
+  const int64_t* region_inpoint;
+  const int64_t* region_length;
+  const ProjFileLane* lanes;
+  const int32_t* point_time;
+  const int16_t* point_value;
+  const char* strings;
+
+  void* map;
+  size_t map_size;
+};
+
+// contents of a project file to be written
+struct ProjFileData {
+  double bpm;
+  std::vector<ProjFileTrack> tracks;
+  std::vector<uint32_t> region_id;
+  std::vector<int32_t> region_instrument;
+  std::vector<int64_t> region_inpoint;
+  std::vector<int64_t> region_length;
+  std::vector<ProjFileLane> lanes;
+  std::vector<int32_t> point_time;
+  std::vector<int16_t> point_value;
+  std::string strings;
+
+  // adds s to the string table, returns its offset
+  uint32_t add_string(const char* s);
+};
+
+// maps and validates the project file at path; returns 0 if it is missing,
+// not a project file or inconsistent
+int projfile_open(const char* path, ProjFile* pf);
+void projfile_close(ProjFile* pf);
+
+// written to a temporary file first so that readers never see a partial project
+int projfile_write(const char* path, const ProjFileData& d);
+
+#endif
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "smf.h"
+
+static uint32_t read_be32(const uint8_t* p) {
+  return (p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+}
+
+static uint16_t read_be16(const uint8_t* p) {
+  return (p[0]<<8) | p[1];
+}
+
+// variable length quantity, at most 4 bytes. returns 0 on truncated input.
+static int read_vlq(const uint8_t** pos, const uint8_t* end, uint32_t* out) {
+  uint32_t v = 0;
+  const uint8_t* p = *pos;
+  for (int i=0; i<4; i++) {
+    if (p>=end) return 0;
+    uint8_t b = *p++;
+    v = (v<<7) | (b&0x7f);
+    if (!(b&0x80)) {
+      *pos = p;
+      *out = v;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int smf_open(const char* path, SMFFile* smf) {
+  memset(smf, 0, sizeof(SMFFile));
+
+  int fd = open(path, O_RDONLY);
+  if (fd<0) {
+    printf("smf_open: cannot open %s\n",path);
+    return 0;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size<14) {
+    printf("smf_open: %s is too short\n",path);
+    close(fd);
+    return 0;
+  }
+
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("smf_open: mmap of %s failed\n",path);
+    return 0;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  smf->data = (const uint8_t*)data;
+  smf->size = st.st_size;
+
+  const uint8_t* p = smf->data;
+  uint32_t header_len = read_be32(p+4);
+  if (memcmp(p, "MThd", 4) || header_len<6 || 8+header_len>smf->size) {
+    printf("smf_open: %s is not a standard MIDI file\n",path);
+    smf_close(smf);
+    return 0;
+  }
+
+  smf->format = read_be16(p+8);
+  smf->num_tracks = read_be16(p+10);
+  smf->division = read_be16(p+12);
+  smf->next_chunk = p+8+header_len;
+
+  if (smf->format>1 || (smf->division&0x8000) || smf->division==0) {
+    printf("smf_open: unsupported format %d / division 0x%x\n",smf->format,smf->division);
+    smf_close(smf);
+    return 0;
+  }
+
+  return 1;
+}
+
+void smf_close(SMFFile* smf) {
+  if (smf->data) munmap((void*)smf->data, smf->size);
+  smf->data = NULL;
+}
+
+// positions the reader on the next MTrk chunk, skipping unknown chunks
+int smf_next_track(SMFFile* smf, SMFTrackReader* rd) {
+  const uint8_t* end = smf->data+smf->size;
+  const uint8_t* p = smf->next_chunk;
+
+  while (p && p+8<=end) {
+    uint32_t len = read_be32(p+4);
+    const uint8_t* body = p+8;
+    const uint8_t* body_end = (len>(size_t)(end-body)) ? end : body+len; // clamp truncated files
+
+    p = body_end;
+    smf->next_chunk = p;
+
+    if (!memcmp(body-8, "MTrk", 4)) {
+      rd->pos = body;
+      rd->end = body_end;
+      rd->tick = 0;
+      rd->running_status = 0;
+      return 1;
+    }
+  }
+  smf->next_chunk = end;
+  return 0;
+}
+
+int smf_next_event(SMFTrackReader* rd, SMFEvent* ev) {
+  if (rd->pos>=rd->end) return 0; // no end of track event, but nothing cut off either
+
+  uint32_t delta;
+  if (!read_vlq(&rd->pos, rd->end, &delta)) return SMF_ERROR;
+  if (rd->pos>=rd->end) return SMF_ERROR;
+
+  rd->tick += delta;
+  ev->tick = rd->tick;
+  ev->meta_type = 0;
+  ev->data1 = 0;
+  ev->data2 = 0;
+  ev->payload = NULL;
+  ev->payload_len = 0;
+
+  uint8_t status = *rd->pos;
+  if (status&0x80) {
+    rd->pos++;
+  } else {
+    // running status: reuse last channel status, this byte is data
+    status = rd->running_status;
+    if (!status) return SMF_ERROR;
+  }
+  ev->status = status;
+
+  if (status<0xf0) {
+    rd->running_status = status;
+
+    int len = ((status&0xf0)==0xc0 || (status&0xf0)==0xd0) ? 1 : 2;
+    if (rd->end-rd->pos<len) return SMF_ERROR;
+    ev->data1 = rd->pos[0]&0x7f;
+    if (len==2) ev->data2 = rd->pos[1]&0x7f;
+    rd->pos += len;
+    return 1;
+  }
+
+  if (status==0xff) {
+    if (rd->pos>=rd->end) return SMF_ERROR;
+    ev->meta_type = *rd->pos++;
+  } else if (status!=0xf0 && status!=0xf7) {
+    return SMF_ERROR; // system realtime/common messages are not allowed in files
+  }
+  rd->running_status = 0;
+
+  uint32_t len;
+  if (!read_vlq(&rd->pos, rd->end, &len)) return SMF_ERROR;
+  if (len>(uint32_t)(rd->end-rd->pos)) return SMF_ERROR;
+
+  ev->payload = rd->pos;
+  ev->payload_len = len;
+  rd->pos += len;
+
+  if (status==0xff && ev->meta_type==SMF_META_END_OF_TRACK) return 0;
+  return 1;
+}
+
+static void put_be32(std::vector<uint8_t>& b, uint32_t v) {
+  b.push_back(v>>24);
+  b.push_back(v>>16);
+  b.push_back(v>>8);
+  b.push_back(v);
+}
+
+// values above SMF_MAX_VLQ don't fit into 4 bytes and are clamped
+static void put_vlq(std::vector<uint8_t>& b, uint32_t v) {
+  if (v>SMF_MAX_VLQ) v = SMF_MAX_VLQ;
+  uint8_t tmp[4];
+  int n = 0;
+  tmp[n++] = v&0x7f;
+  while (v>>=7) {
+    tmp[n++] = (v&0x7f)|0x80;
+  }
+  while (n--) b.push_back(tmp[n]);
+}
+
+void smf_write_header(SMFWriter* w, int format, int num_tracks, int division) {
+  w->buf.clear();
+  w->buf.insert(w->buf.end(), (const uint8_t*)"MThd", (const uint8_t*)"MThd"+4);
+  put_be32(w->buf, 6);
+  w->buf.push_back(format>>8);
+  w->buf.push_back(format);
+  w->buf.push_back(num_tracks>>8);
+  w->buf.push_back(num_tracks);
+  w->buf.push_back(division>>8);
+  w->buf.push_back(division);
+}
+
+void smf_write_begin_track(SMFWriter* w) {
+  w->buf.insert(w->buf.end(), (const uint8_t*)"MTrk", (const uint8_t*)"MTrk"+4);
+  put_be32(w->buf, 0); // patched in smf_write_end_track
+  w->track_start = w->buf.size();
+  w->last_tick = 0;
+}
+
+// events have to be written in tick order. no running status is used. an
+// event more than SMF_MAX_VLQ ticks after the previous one is moved closer.
+void smf_write_event(SMFWriter* w, uint32_t tick, const uint8_t* data, int len) {
+  if (tick<w->last_tick) tick = w->last_tick;
+  if (tick-w->last_tick>SMF_MAX_VLQ) tick = w->last_tick+SMF_MAX_VLQ;
+  put_vlq(w->buf, tick-w->last_tick);
+  w->last_tick = tick;
+  w->buf.insert(w->buf.end(), data, data+len);
+}
+
+void smf_write_tempo(SMFWriter* w, uint32_t tick, double bpm) {
+  uint32_t usec = (uint32_t)(60000000.0/bpm);
+  uint8_t ev[6] = {0xff, SMF_META_TEMPO, 3, (uint8_t)(usec>>16), (uint8_t)(usec>>8), (uint8_t)usec};
+  smf_write_event(w, tick, ev, 6);
+}
+
+void smf_write_end_track(SMFWriter* w) {
+  uint8_t eot[3] = {0xff, SMF_META_END_OF_TRACK, 0};
+  smf_write_event(w, w->last_tick, eot, 3);
+
+  uint32_t len = w->buf.size()-w->track_start;
+  uint8_t* p = &w->buf[w->track_start-4];
+  p[0] = len>>24;
+  p[1] = len>>16;
+  p[2] = len>>8;
+  p[3] = len;
+}
+
+int smf_write_file(SMFWriter* w, const char* path) {
+  if (w->buf.empty()) {
+    printf("smf_write_file: no header written for %s\n",path);
+    return 0;
+  }
+  FILE* f = fopen(path,"wb");
+  if (!f) {
+    printf("smf_write_file: cannot open %s\n",path);
+    return 0;
+  }
+  size_t written = fwrite(&w->buf[0], 1, w->buf.size(), f);
+  fclose(f);
+  return written == w->buf.size();
+}
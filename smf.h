@@ -0,0 +1,66 @@
+#ifndef SMF_H
+#define SMF_H
+
+// Standard MIDI File (type 0/1) reading and writing.
+// the reader works directly on the mmap'd file and never copies event data.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+struct SMFFile {
+  const uint8_t* data; // mmap'd file
+  size_t size;
+
+  int format;
+  int num_tracks;
+  int division; // ticks per quarter note
+
+  const uint8_t* next_chunk;
+};
+
+struct SMFTrackReader {
+  const uint8_t* pos;
+  const uint8_t* end;
+  uint32_t tick; // absolute tick of the last event
+  uint8_t running_status;
+};
+
+struct SMFEvent {
+  uint32_t tick;
+  uint8_t status;    // 0x80-0xef channel messages, 0xf0/0xf7 sysex, 0xff meta
+  uint8_t meta_type;
+  uint8_t data1;
+  uint8_t data2;
+
+  const uint8_t* payload; // meta/sysex bytes, points into the mapping
+  uint32_t payload_len;
+};
+
+#define SMF_META_END_OF_TRACK 0x2f
+#define SMF_META_TEMPO 0x51
+
+#define SMF_ERROR -1
+#define SMF_MAX_VLQ 0x0fffffff // largest delta time or length a file can hold
+
+int  smf_open(const char* path, SMFFile* smf);
+void smf_close(SMFFile* smf);
+int  smf_next_track(SMFFile* smf, SMFTrackReader* rd);
+// 1: *ev holds the next event, 0: end of track, SMF_ERROR: the track is
+// malformed or cut off at the reader's position
+int  smf_next_event(SMFTrackReader* rd, SMFEvent* ev);
+
+struct SMFWriter {
+  std::vector<uint8_t> buf;
+  size_t track_start;
+  uint32_t last_tick;
+};
+
+void smf_write_header(SMFWriter* w, int format, int num_tracks, int division);
+void smf_write_begin_track(SMFWriter* w);
+void smf_write_event(SMFWriter* w, uint32_t tick, const uint8_t* data, int len);
+void smf_write_tempo(SMFWriter* w, uint32_t tick, double bpm);
+void smf_write_end_track(SMFWriter* w);
+int  smf_write_file(SMFWriter* w, const char* path);
+
+#endif
@@ -0,0 +1,141 @@
+// kills a process that is journaling edits and checks that reading the
+// journal gives back the edits in order, without a cut off line, and that
+// resuming it after the replay keeps them.
+//
+// build and run with tests/journal_test.sh
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "journal.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: failed: %s\n",__FILE__,__LINE__,#cond); failures++; } } while (0)
+
+// the edit of step i, as journal_step() writes them
+static std::string edit_line(int i) {
+  char buf[128];
+  if (i%5==4) snprintf(buf,127,"(let () (region-delete %d))",i-2);
+  else snprintf(buf,127,"(let () (region-delete %d) (region %d %d %d %d 250))",i,i,i%3,i%3,i*125);
+  return std::string(buf);
+}
+
+// applies an edit line to a map of region id -> inpoint
+static void replay(const std::string& line, std::map<int, int>& regions) {
+  int id, track, instrument, inpoint, length;
+  const char* p = line.c_str();
+  while ((p = strchr(p+1, '('))) {
+    if (sscanf(p, "(region-delete %d)", &id)==1) {
+      regions.erase(id);
+    } else if (sscanf(p, "(region %d %d %d %d %d)", &id, &track, &instrument, &inpoint, &length)==5) {
+      regions[id] = inpoint;
+    }
+  }
+}
+
+static void write_file(const char* path, const char* data) {
+  FILE* f = fopen(path, "w");
+  fputs(data, f);
+  fclose(f);
+}
+
+// journals edits until it is killed; tells the parent through fd once the
+// session is under way
+static void child_session(const char* project, int fd) {
+  journal_start(project, 1);
+  for (int i=0; ; i++) {
+    journal_append(edit_line(i));
+    if (i==1000 && write(fd, "x", 1)!=1) exit(1);
+    if (i%16==0) usleep(10);
+  }
+}
+
+int main() {
+  char dir[] = "/tmp/journal_test.XXXXXX";
+  if (!mkdtemp(dir)) return 1;
+  std::string project = std::string(dir)+"/song.l";
+  std::string journal = project+".journal";
+  write_file(project.c_str(), "(bpm 120 0)\n");
+
+  int fds[2];
+  if (pipe(fds)) return 1;
+  pid_t pid = fork();
+  if (!pid) {
+    close(fds[0]);
+    child_session(project.c_str(), fds[1]);
+  }
+  close(fds[1]);
+
+  char c;
+  CHECK(read(fds[0], &c, 1)==1);
+  usleep(100000);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+
+  // the journal holds the first edits of the session, complete and in order
+  int from_file = 0;
+  std::vector<std::string> entries;
+  CHECK(journal_read(project.c_str(), &from_file, &entries));
+  CHECK(from_file);
+  CHECK(entries.size()>1000);
+
+  std::map<int, int> recovered, expected;
+  for (size_t i=0; i<entries.size(); i++) {
+    CHECK(entries[i]==edit_line(i));
+    replay(entries[i], recovered);
+    replay(edit_line(i), expected);
+  }
+  CHECK(recovered==expected);
+  size_t edits = entries.size();
+
+  // a line the crash cut off is not replayed
+  FILE* f = fopen(journal.c_str(), "a");
+  fputs("(let () (region 1 0", f);
+  fclose(f);
+  CHECK(journal_read(project.c_str(), &from_file, &entries));
+  CHECK(entries.size()==edits);
+
+  // loading the project resumes the journal with the replayed edits, so a
+  // second crash does not lose them
+  journal_resume(project.c_str(), from_file, entries);
+  journal_append("(let () (bpm 90 0))");
+  journal_stop();
+  CHECK(journal_read(project.c_str(), &from_file, &entries));
+  CHECK(entries.size()==edits+1);
+  CHECK(entries.size() && entries.back()=="(let () (bpm 90 0))");
+
+  // saving the project again makes the entries stale
+  write_file(project.c_str(), "(bpm 120 0)\n(track 0 \"midi\" 36 0 1 4 2 10)\n");
+  CHECK(!journal_read(project.c_str(), &from_file, &entries));
+
+  // a snapshot replaces the entries with the lines its builder appends on
+  // the writer thread, followed by the edits made after it
+  journal_start(project.c_str(), 1);
+  journal_append("(let () (bpm 90 0))");
+  journal_snapshot([](std::string& lines) { lines += "(bpm 90 0)\n"; });
+  journal_append("(let () (bpm 100 0))");
+  journal_stop();
+  CHECK(journal_read(project.c_str(), &from_file, &entries));
+  CHECK(!from_file);
+  CHECK(entries.size()==2 && entries[0]=="(bpm 90 0)" && entries[1]=="(let () (bpm 100 0))");
+
+  remove(journal.c_str());
+  remove(project.c_str());
+  rmdir(dir);
+
+  if (failures) {
+    printf("journal_test: %d checks failed\n",failures);
+    return 1;
+  }
+  printf("journal_test: ok, %d edits recovered\n",(int)edits);
+  return 0;
+}
@@ -0,0 +1,4 @@
+#!/bin/sh
+# builds and runs the journal crash test
+cd "$(dirname "$0")"
+g++ -g -I.. ../journal.cpp journal_test.cpp -lpthread -std=gnu++11 -o journal_test && ./journal_test
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+
+#include "uistats.h"
+
+using namespace glv;
+
+UIStats ui_stats;
+
+static unsigned last_glv_frame = 0;
+
+double uistats_now_ms() {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int uistats_frame(GLV& g) {
+  if (g.frames()==last_glv_frame) return 0;
+  last_glv_frame = g.frames();
+
+  float ms = g.drawTime()*1000.0;
+  int bucket = (int)ms;
+  if (bucket>=UISTATS_BUCKETS) bucket = UISTATS_BUCKETS-1;
+
+  ui_stats.frame_ms[ui_stats.frames%UISTATS_HISTORY] = ms;
+  ui_stats.frame_hist[bucket]++;
+  ui_stats.frame_total_ms += ms;
+  if (ms>ui_stats.frame_max_ms) ui_stats.frame_max_ms = ms;
+  ui_stats.frames++;
+
+  ui_stats.views_visited = g.viewsVisited();
+  ui_stats.views_drawn = g.viewsDrawn();
+  ui_stats.draw_calls = g.drawCalls();
+  return 1;
+}
+
+void uistats_update_ui(float ms) {
+  ui_stats.update_ui_ms = ms;
+  if (ms>ui_stats.update_ui_max_ms) ui_stats.update_ui_max_ms = ms;
+}
+
+void uistats_eval(float ms) {
+  ui_stats.evals++;
+  ui_stats.eval_ms = ms;
+  if (ms>ui_stats.eval_max_ms) ui_stats.eval_max_ms = ms;
+}
+
+void uistats_reset() {
+  memset(&ui_stats, 0, sizeof(UIStats));
+}
+
+float uistats_frame_percentile(float p) {
+  uint32_t total = 0;
+  for (int i=0; i<UISTATS_BUCKETS; i++) total += ui_stats.frame_hist[i];
+  if (!total) return 0;
+
+  uint32_t needed = (uint32_t)ceil(total*p/100.0);
+  uint32_t count = 0;
+  for (int i=0; i<UISTATS_BUCKETS; i++) {
+    count += ui_stats.frame_hist[i];
+    if (count>=needed) return i+1;
+  }
+  return UISTATS_BUCKETS;
+}
+
+// one vertical line per histogram bucket
+struct BarsMap : public GraphicsMap {
+  virtual void onMap(GraphicsData& g, const Data& d, const Indexer& i) {
+    for (int x=0; x<d.size(1); x++) {
+      g.addVertex(x+0.5, 0);
+      g.addVertex(x+0.5, d.at<double>(0, x));
+    }
+  }
+};
+
+UIStatsOverlay::UIStatsOverlay(const Rect& r):
+  View(r),
+  history(Rect(5, 25, r.w-10, (r.h-30)/2)),
+  histogram(Rect(5, 30+(r.h-30)/2, r.w-10, (r.h-30)/2-5)),
+  summary("", false)
+{
+  colors().set(Color(0,0,0,0.8), 0.5);
+  disable(HitTest);
+
+  history_line = new PlotFunction1D(Color(1,1,1));
+  history_line->prim(draw::LineStrip);
+  history_line->data().resize(Data::FLOAT, 1, UISTATS_HISTORY);
+  history.add(*history_line);
+  history.range(0, UISTATS_HISTORY, 0).range(0, UISTATS_BUCKETS, 1);
+  history.major(60, 0).major(16.7, 1).minor(1);
+  history.disable(HitTest);
+
+  bars_map = new BarsMap;
+  histogram_bars = new Plottable(draw::Lines, 4, Color(0.2,0.6,1));
+  histogram_bars->add(*bars_map);
+  histogram_bars->data().resize(Data::FLOAT, 1, UISTATS_BUCKETS);
+  histogram.add(*histogram_bars);
+  histogram.range(0, UISTATS_BUCKETS, 0).range(0, 1, 1);
+  histogram.major(16.7, 0).major(1, 1).minor(1);
+  histogram.disable(HitTest);
+
+  summary.size(8);
+  summary.pos(5, 5);
+  summary.disable(HitTest);
+
+  *this << history << histogram << summary;
+}
+
+UIStatsOverlay::~UIStatsOverlay() {
+  delete history_line;
+  delete histogram_bars;
+  delete bars_map;
+}
+
+void UIStatsOverlay::sync() {
+  // oldest frame on the left
+  for (int i=0; i<UISTATS_HISTORY; i++) {
+    uint32_t f = ui_stats.frames+i;
+    float ms = f<UISTATS_HISTORY ? 0 : ui_stats.frame_ms[f%UISTATS_HISTORY];
+    history_line->data().assign(ms, 0, i);
+  }
+
+  // histogram is normalized to the most common frame time
+  uint32_t peak = 1;
+  for (int i=0; i<UISTATS_BUCKETS; i++) {
+    if (ui_stats.frame_hist[i]>peak) peak = ui_stats.frame_hist[i];
+  }
+  for (int i=0; i<UISTATS_BUCKETS; i++) {
+    histogram_bars->data().assign((float)ui_stats.frame_hist[i]/peak, 0, i);
+  }
+
+  char buf[256];
+  snprintf(buf,255,"frame %.2fms p95 %.0fms max %.1fms  views %d/%d  draws %d  update_ui %.2fms  eval %.1fms",
+           ui_stats.frame_ms[(ui_stats.frames+UISTATS_HISTORY-1)%UISTATS_HISTORY],
+           uistats_frame_percentile(95), ui_stats.frame_max_ms,
+           ui_stats.views_drawn, ui_stats.views_visited, ui_stats.draw_calls,
+           ui_stats.update_ui_ms, ui_stats.eval_ms);
+  summary.setValue(std::string(buf));
+}
@@ -0,0 +1,66 @@
+#ifndef UISTATS_H
+#define UISTATS_H
+
+// timing and drawing counters of the UI thread. collected every frame,
+// shown by the stats overlay and readable from lisp with (ui-stats).
+
+#include <stdint.h>
+#include "glv.h"
+
+#define UISTATS_HISTORY 240 // frames kept for the frame time plot
+#define UISTATS_BUCKETS 34  // 1ms wide frame time buckets, the last one collects everything slower
+
+struct UIStats {
+  uint32_t frames;
+  float frame_ms[UISTATS_HISTORY]; // ring buffer indexed by frames
+  uint32_t frame_hist[UISTATS_BUCKETS];
+  double frame_total_ms;
+  float frame_max_ms;
+
+  // last frame
+  uint32_t views_visited;
+  uint32_t views_drawn;
+  uint32_t draw_calls;
+
+  float update_ui_ms;
+  float update_ui_max_ms;
+
+  // lisp evaluation per key press
+  uint32_t evals;
+  float eval_ms;
+  float eval_max_ms;
+};
+
+extern UIStats ui_stats;
+
+double uistats_now_ms();
+
+// records the counters of the last frame drawn by g. may be called more than
+// once per frame, returns 1 only for the first call after a new frame.
+int uistats_frame(glv::GLV& g);
+void uistats_update_ui(float ms);
+void uistats_eval(float ms);
+void uistats_reset();
+
+// frame time below which p percent of the frames were drawn, in whole ms
+float uistats_frame_percentile(float p);
+
+// overlay with frame time history and histogram plus the latest counters
+class UIStatsOverlay : public glv::View {
+public:
+  UIStatsOverlay(const glv::Rect& r);
+  virtual ~UIStatsOverlay();
+
+  // copies the current stats into the plots
+  void sync();
+
+private:
+  glv::Plot history;
+  glv::Plot histogram;
+  glv::Label summary;
+  glv::Plottable* history_line;
+  glv::Plottable* histogram_bars;
+  glv::GraphicsMap* bars_map;
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include <X11/Xlib.h>
 #include <X11/Intrinsic.h>
 #include <X11/StringDefs.h>
+#include <string.h>
+#include <mutex>
 
 typedef void (*custom_x11_event_callback)(XEvent* e);
 
@@ -90,6 +92,11 @@ static Atom supported[NUM_MIMES];
 static Display* dpy;
 static Window win;
 
+// separate connection for waking up the GUI thread from other threads
+static Display* wake_dpy = NULL;
+static Atom ProduceWake;
+static std::mutex wake_lock;
+
 
 void send_finished(Window from, Window to)
 {
@@ -156,6 +163,23 @@ char* get_dropped_filenames(XEvent* xev, Window src)
 }
 
 extern void file_dropped_callback(char* uri);
+extern void wake_callback();
+
+// makes the GUI thread's event wait return and call wake_callback().
+// safe to call from any thread.
+void x11_wake() {
+  std::lock_guard<std::mutex> lock(wake_lock);
+  if (!wake_dpy) return;
+
+  XEvent xevent;
+  memset(&xevent, 0, sizeof (xevent));
+  xevent.xany.type = ClientMessage;
+  xevent.xclient.window = win;
+  xevent.xclient.message_type = ProduceWake;
+  xevent.xclient.format = 32;
+  XSendEvent(wake_dpy, win, False, NoEventMask, &xevent);
+  XFlush(wake_dpy);
+}
 
 void xev_callback(XEvent* e) {
   //printf("xev_callback! %x\n",e->type);
@@ -168,7 +192,10 @@ void xev_callback(XEvent* e) {
     
     //printf("ClientMessage event: %p type: %d format: %d\n",&cme,cme.message_type,cme.format);
 
-    if (XdndPosition == cme.message_type) {
+    if (ProduceWake == cme.message_type) {
+      wake_callback();
+    }
+    else if (XdndPosition == cme.message_type) {
       source = cme.data.l[0];
       
       //printf("got XdndPosition! source window: %x\n",source);
@@ -283,10 +310,18 @@ void x11_stuff_init()
   XChangeProperty(dpy, win, XdndTypeList, XA_ATOM, 32,
                   PropModeAppend, (unsigned char *)supported, NUM_MIMES);
   
+  ProduceWake = XInternAtom(dpy, "PRODUCE_WAKE", False);
+  wake_dpy = XOpenDisplay(NULL);
+
   fg_set_custom_x11_event_callback(xev_callback);
 }
 
 void x11_exit_cleanup() {
+  {
+    std::lock_guard<std::mutex> lock(wake_lock);
+    if (wake_dpy) XCloseDisplay(wake_dpy);
+    wake_dpy = NULL;
+  }
   XCloseDisplay(x11_dsp);
 }
 